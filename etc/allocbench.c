@@ -0,0 +1,119 @@
+/*
+** $Id: allocbench.c $
+** Microbenchmark for the slab allocator of 'ilyaL_newslabstate'
+** See Copyright Notice in ilya.h
+**
+** Build (from the source directory, after 'make'):
+**   cc -O2 -I. etc/allocbench.c libilya.a -lm -ldl -o allocbench
+** Usage: ./allocbench [n]
+**
+** It times 'n' rounds of two workloads, once with the slab allocator
+** and once with a plain allocator over 'realloc'/'free':
+**   raw: random-sized blocks (up to 256 bytes) allocated and freed
+**        in random order by calling the allocator fn directly;
+**   ilya: a script creating short-lived tables, strings and closures.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "ilya.h"
+#include "lauxlib.h"
+#include "ilyalib.h"
+
+
+#define NBLOCKS		4096
+#define MAXBLOCK	256
+
+
+static void *plain_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
+  (void)ud; (void)osize;
+  if (nsize == 0) {
+    free(ptr);
+    return NULL;
+  }
+  else
+    return realloc(ptr, nsize);
+}
+
+
+static const char script[] =
+  "lock t = {}\n"
+  "for i = 1, 20000 do\n"
+  "  lock x = {i, tostring(i), {}}\n"
+  "  x.f = fn () return x end\n"
+  "  t[i % 512 + 1] = x\n"
+  "end\n";
+
+
+static double rawbench (ilya_Alloc f, void *ud, int n) {
+  static void *blocks[NBLOCKS];
+  static size_t sizes[NBLOCKS];
+  unsigned int seed = 1;
+  clock_t c = clock();
+  int i, r;
+  for (r = 0; r < n; r++) {
+    for (i = 0; i < 16 * NBLOCKS; i++) {
+      int k;
+      seed = seed * 1103515245u + 12345u;
+      k = (int)((seed >> 8) % NBLOCKS);
+      if (blocks[k] != NULL) {
+        f(ud, blocks[k], sizes[k], 0);
+        blocks[k] = NULL;
+      }
+      else {
+        sizes[k] = 8 + (seed >> 20) % (MAXBLOCK - 8);
+        blocks[k] = f(ud, NULL, ILYA_TTABLE, sizes[k]);
+      }
+    }
+  }
+  for (i = 0; i < NBLOCKS; i++) {
+    if (blocks[i] != NULL) {
+      f(ud, blocks[i], sizes[i], 0);
+      blocks[i] = NULL;
+    }
+  }
+  return (double)(clock() - c) / CLOCKS_PER_SEC;
+}
+
+
+static double ilyabench (ilya_State *L, int n) {
+  clock_t c = clock();
+  int r;
+  ilyaL_openlibs(L);
+  for (r = 0; r < n; r++) {
+    if (ilyaL_dostring(L, script) != ILYA_OK) {
+      fprintf(stderr, "%s\n", ilya_tostring(L, -1));
+      exit(EXIT_FAILURE);
+    }
+  }
+  return (double)(clock() - c) / CLOCKS_PER_SEC;
+}
+
+
+int main (int argc, char *argv[]) {
+  int n = (argc > 1) ? atoi(argv[1]) : 20;
+  ilya_State *L = ilyaL_newslabstate();
+  ilya_State *L1 = ilya_newstate(plain_alloc, NULL, 0);
+  ilyaL_AllocStats st;
+  ilya_Alloc f;
+  void *ud;
+  if (L == NULL || L1 == NULL || !ilyaL_allocstats(L, &st)) {
+    fprintf(stderr, "cannot create states (or no slab allocator)\n");
+    return EXIT_FAILURE;
+  }
+  f = ilya_getallocf(L, &ud);
+  printf("raw:  slab %.3fs  malloc %.3fs\n",
+         rawbench(f, ud, n), rawbench(plain_alloc, NULL, n));
+  printf("ilya: slab %.3fs  malloc %.3fs\n",
+         ilyabench(L, n), ilyabench(L1, n));
+  ilyaL_allocstats(L, &st);
+  printf("slab allocs %lu, frees %lu, large %lu, slabs %lu, released %lu\n",
+         (unsigned long)st.nalloc, (unsigned long)st.nfree,
+         (unsigned long)st.nlarge, (unsigned long)st.nslabs,
+         (unsigned long)st.nreleased);
+  ilya_close(L);
+  ilya_close(L1);
+  return 0;
+}
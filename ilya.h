@@ -161,6 +161,7 @@ extern const char ilya_ident[];
 ** state manipulation
 */
 ILYA_API ilya_State *(ilya_newstate) (ilya_Alloc f, void *ud, unsigned seed);
+ILYA_API ilya_State *(ilya_newarena) (ilya_Alloc f, void *ud, unsigned seed);
 ILYA_API void       (ilya_close) (ilya_State *L);
 ILYA_API ilya_State *(ilya_newthread) (ilya_State *L);
 ILYA_API int        (ilya_closethread) (ilya_State *L, ilya_State *from);
@@ -268,6 +269,9 @@ ILYA_API int (ilya_rawgeti) (ilya_State *L, int idx, ilya_Integer n);
 ILYA_API int (ilya_rawgetp) (ilya_State *L, int idx, const void *p);
 
 ILYA_API void  (ilya_createtable) (ilya_State *L, int narr, int nrec);
+ILYA_API void  (ilya_clonetable) (ilya_State *L, int idx);
+ILYA_API void  (ilya_freezetable) (ilya_State *L, int idx);
+ILYA_API int   (ilya_isfrozen) (ilya_State *L, int idx);
 ILYA_API void *(ilya_newuserdatauv) (ilya_State *L, size_t sz, int nuvalue);
 ILYA_API int   (ilya_getmetatable) (ilya_State *L, int objindex);
 ILYA_API int  (ilya_getiuservalue) (ilya_State *L, int idx, int n);
@@ -338,6 +342,10 @@ ILYA_API void (ilya_warning)  (ilya_State *L, const char *msg, int tocont);
 #define ILYA_GCGEN		7
 #define ILYA_GCINC		8
 #define ILYA_GCPARAM		9
+#define ILYA_GCAUTO		10
+#define ILYA_GCSTAT		11
+#define ILYA_GCLIMIT		12
+#define ILYA_GCPEAK		13
 
 
 /*
@@ -357,6 +365,32 @@ ILYA_API void (ilya_warning)  (ilya_State *L, const char *msg, int tocont);
 #define ILYA_GCPN		6
 
 
+/*
+** garbage-collection statistics (option ILYA_GCSTAT)
+*/
+#define ILYA_GCSMINOR		0  /* number of minor collections */
+#define ILYA_GCSMAJOR		1  /* number of major collections */
+#define ILYA_GCSINC		2  /* number of incremental cycles */
+#define ILYA_GCSMINORWORK	3  /* Kbytes marked by minor collections */
+#define ILYA_GCSMAJORWORK	4  /* Kbytes marked by major collections */
+#define ILYA_GCSINCWORK		5  /* Kbytes marked by incremental cycles */
+#define ILYA_GCSSURVIVAL	6  /* % of new bytes surviving minor coll. */
+#define ILYA_GCSSWITCHES	7  /* mode switches done by the auto mode */
+#define ILYA_GCSDECISION	8  /* last decision of the auto mode */
+#define ILYA_GCSPAUSES		9  /* first bucket of the pause histogram */
+
+/* number of buckets in the pause histogram */
+#define ILYA_GCSNPAUSES		12
+
+/* decisions of the auto mode */
+#define ILYA_GCDNONE		0  /* no decision yet */
+#define ILYA_GCDTOINC		1  /* switched to incremental mode */
+#define ILYA_GCDTOGEN		2  /* switched (back) to generational mode */
+#define ILYA_GCDMINORMUL	3  /* changed the minor multiplier */
+#define ILYA_GCDMINORMAJOR	4  /* changed the minor-major multiplier */
+#define ILYA_GCDMAJORMINOR	5  /* changed the major-minor multiplier */
+
+
 ILYA_API int (ilya_gc) (ilya_State *L, int what, ...);
 
 
@@ -367,6 +401,10 @@ ILYA_API int (ilya_gc) (ilya_State *L, int what, ...);
 ILYA_API int   (ilya_error) (ilya_State *L);
 
 ILYA_API int   (ilya_next) (ilya_State *L, int idx);
+ILYA_API int   (ilya_compacttable) (ilya_State *L, int idx);
+ILYA_API int   (ilya_sortnumbers) (ilya_State *L, int idx, ilya_Integer n);
+ILYA_API ilya_Integer (ilya_siftheap) (ilya_State *L, int idx,
+                                ilya_Integer n, ilya_Integer i, int up);
 
 ILYA_API void  (ilya_concat) (ilya_State *L, int n);
 ILYA_API void  (ilya_len)    (ilya_State *L, int idx);
@@ -378,6 +416,11 @@ ILYA_API size_t  (ilya_stringtonumber) (ilya_State *L, const char *s);
 ILYA_API ilya_Alloc (ilya_getallocf) (ilya_State *L, void **ud);
 ILYA_API void      (ilya_setallocf) (ilya_State *L, ilya_Alloc f, void *ud);
 
+ILYA_API size_t (ilya_setmemlimit) (ilya_State *L, size_t limit);
+ILYA_API size_t (ilya_getmempeak) (ilya_State *L, int reset);
+ILYA_API void (ilya_gcadjust) (ilya_State *L, ptrdiff_t delta);
+ILYA_API int (ilya_internlimit) (ilya_State *L, int limit);
+
 ILYA_API void (ilya_toclose) (ilya_State *L, int idx);
 ILYA_API void (ilya_closeslot) (ilya_State *L, int idx);
 
@@ -491,6 +534,30 @@ ILYA_API int (ilya_gethookmask) (ilya_State *L);
 ILYA_API int (ilya_gethookcount) (ilya_State *L);
 
 
+/*
+** Allocation profiler
+*/
+#define ILYA_MEMLIVE	0  /* bytes still allocated */
+#define ILYA_MEMTOTAL	1  /* all bytes allocated */
+
+ILYA_API int (ilya_memprofile) (ilya_State *L, int rate);
+ILYA_API int (ilya_memreport) (ilya_State *L, int what, ilya_Writer writer,
+                                                      void *data);
+ILYA_API int (ilya_heapsnapshot) (ilya_State *L, ilya_Writer writer,
+                                              void *data);
+
+
+/*
+** Memory accounting
+*/
+/* entries filled by 'ilya_typememory': basic types, upvalues, prototypes */
+#define ILYA_NUMMEMTYPES	(ILYA_NUMTYPES + 2)
+
+ILYA_API int (ilya_memaccount) (ilya_State *L, int on);
+ILYA_API void (ilya_typememory) (ilya_State *L, size_t *bytes);
+ILYA_API size_t (ilya_threadmemory) (ilya_State *L, ilya_State *co);
+
+
 struct ilya_Debug {
   int event;
   const char *name;	/* (n) */
@@ -746,6 +746,15 @@
 */
 /* #define ILYA_USE_APICHECK */
 
+
+/*
+@@ ILYA_SWISSHASH makes the hash part of tables use open addressing
+** with groups of control bytes (searched with SSE2, when available)
+** instead of chained scatter. Hash parts keep 1/8 of their nodes free,
+** so they may be larger than with the default layout.
+*/
+/* #define ILYA_SWISSHASH */
+
 /* }================================================================== */
 
 
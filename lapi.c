@@ -795,6 +795,38 @@ ILYA_API void ilya_createtable (ilya_State *L, int narray, int nrec) {
 }
 
 
+ILYA_API void ilya_clonetable (ilya_State *L, int idx) {
+  Table *t, *c;
+  ilya_lock(L);
+  t = gettable(L, idx);
+  c = ilyaH_new(L);
+  sethvalue2s(L, L->top.p, c);
+  api_incr_top(L);
+  ilyaH_copy(L, c, t);
+  ilyaC_checkGC(L);
+  ilya_unlock(L);
+}
+
+
+ILYA_API void ilya_freezetable (ilya_State *L, int idx) {
+  Table *t;
+  ilya_lock(L);
+  t = gettable(L, idx);
+  ilyaH_freeze(L, t);
+  ilyaC_checkGC(L);
+  ilya_unlock(L);
+}
+
+
+ILYA_API int ilya_isfrozen (ilya_State *L, int idx) {
+  int res;
+  ilya_lock(L);
+  res = (isfrozen(gettable(L, idx)) != 0);
+  ilya_unlock(L);
+  return res;
+}
+
+
 ILYA_API int ilya_getmetatable (ilya_State *L, int objindex) {
   const TValue *obj;
   Table *mt;
@@ -855,7 +887,9 @@ static void auxsetstr (ilya_State *L, const TValue *t, const char *k) {
   api_checkpop(L, 1);
   ilyaV_fastset(t, str, s2v(L->top.p - 1), hres, ilyaH_psetstr);
   if (hres == HOK) {
-    ilyaV_finishfastset(L, t, s2v(L->top.p - 1));
+    TValue tk;  /* key as a TValue */
+    setsvalue(L, &tk, str);
+    ilyaV_finishfastset(L, t, &tk, s2v(L->top.p - 1));
     L->top.p--;  /* pop value */
   }
   else {
@@ -884,7 +918,7 @@ ILYA_API void ilya_settable (ilya_State *L, int idx) {
   t = index2value(L, idx);
   ilyaV_fastset(t, s2v(L->top.p - 2), s2v(L->top.p - 1), hres, ilyaH_pset);
   if (hres == HOK) {
-    ilyaV_finishfastset(L, t, s2v(L->top.p - 1));
+    ilyaV_finishfastset(L, t, s2v(L->top.p - 2), s2v(L->top.p - 1));
   }
   else
     ilyaV_finishset(L, t, s2v(L->top.p - 2), s2v(L->top.p - 1), hres);
@@ -902,17 +936,16 @@ ILYA_API void ilya_setfield (ilya_State *L, int idx, const char *k) {
 ILYA_API void ilya_seti (ilya_State *L, int idx, ilya_Integer n) {
   TValue *t;
   int hres;
+  TValue temp;
   ilya_lock(L);
   api_checkpop(L, 1);
   t = index2value(L, idx);
   ilyaV_fastseti(t, n, s2v(L->top.p - 1), hres);
+  setivalue(&temp, n);
   if (hres == HOK)
-    ilyaV_finishfastset(L, t, s2v(L->top.p - 1));
-  else {
-    TValue temp;
-    setivalue(&temp, n);
+    ilyaV_finishfastset(L, t, &temp, s2v(L->top.p - 1));
+  else
     ilyaV_finishset(L, t, &temp, s2v(L->top.p - 1), hres);
-  }
   L->top.p--;  /* pop value */
   ilya_unlock(L);
 }
@@ -925,7 +958,7 @@ static void aux_rawset (ilya_State *L, int idx, TValue *key, int n) {
   t = gettable(L, idx);
   ilyaH_set(L, t, key, s2v(L->top.p - 1));
   invalidateTMcache(t);
-  ilyaC_barrierback(L, obj2gco(t), s2v(L->top.p - 1));
+  ilyaC_barriertable(L, t, key, s2v(L->top.p - 1));
   L->top.p -= n;
   ilya_unlock(L);
 }
@@ -945,11 +978,13 @@ ILYA_API void ilya_rawsetp (ilya_State *L, int idx, const void *p) {
 
 ILYA_API void ilya_rawseti (ilya_State *L, int idx, ilya_Integer n) {
   Table *t;
+  TValue k;
   ilya_lock(L);
   api_checkpop(L, 1);
   t = gettable(L, idx);
   ilyaH_setint(L, t, n, s2v(L->top.p - 1));
-  ilyaC_barrierback(L, obj2gco(t), s2v(L->top.p - 1));
+  setivalue(&k, n);
+  ilyaC_barriertable(L, t, &k, s2v(L->top.p - 1));
   L->top.p--;
   ilya_unlock(L);
 }
@@ -969,6 +1004,8 @@ ILYA_API int ilya_setmetatable (ilya_State *L, int objindex) {
   }
   switch (ttype(obj)) {
     case ILYA_TTABLE: {
+      if (l_unlikely(isfrozen(hvalue(obj))))
+        ilyaG_runerror(L, "attempt to modify a frozen table");
       hvalue(obj)->metatable = mt;
       if (mt) {
         ilyaC_objbarrier(L, gcvalue(obj), mt);
@@ -1161,6 +1198,10 @@ ILYA_API int ilya_status (ilya_State *L) {
 /*
 ** Garbage-collection fn
 */
+/* current collector mode, as returned by mode-changing options */
+#define gcmode(g)  \
+	((g)->gcauto ? ILYA_GCAUTO : (g)->gckind == KGC_INC ? ILYA_GCINC : ILYA_GCGEN)
+
 ILYA_API int ilya_gc (ilya_State *L, int what, ...) {
   va_list argp;
   int res = 0;
@@ -1211,15 +1252,43 @@ ILYA_API int ilya_gc (ilya_State *L, int what, ...) {
       break;
     }
     case ILYA_GCGEN: {
-      res = (g->gckind == KGC_INC) ? ILYA_GCINC : ILYA_GCGEN;
+      res = gcmode(g);
+      g->gcauto = 0;
       ilyaC_changemode(L, KGC_GENMINOR);
       break;
     }
     case ILYA_GCINC: {
-      res = (g->gckind == KGC_INC) ? ILYA_GCINC : ILYA_GCGEN;
+      res = gcmode(g);
+      g->gcauto = 0;
       ilyaC_changemode(L, KGC_INC);
       break;
     }
+    case ILYA_GCAUTO: {
+      res = gcmode(g);
+      ilyaC_setauto(L);
+      break;
+    }
+    case ILYA_GCSTAT: {
+      int stat = va_arg(argp, int);
+      res = ilyaC_gcstat(L, stat);
+      break;
+    }
+    case ILYA_GCLIMIT: {  /* limit in Kbytes; negative keeps it */
+      int kb = va_arg(argp, int);
+      l_mem old = g->memlimit >> 10;
+      res = (old < INT_MAX) ? cast_int(old) : INT_MAX;
+      if (kb >= 0)
+        g->memlimit = cast(l_mem, kb) << 10;
+      break;
+    }
+    case ILYA_GCPEAK: {  /* peak in Kbytes */
+      int reset = va_arg(argp, int);
+      l_mem peak = g->mempeak >> 10;
+      res = (peak < INT_MAX) ? cast_int(peak) : INT_MAX;
+      if (reset)
+        g->mempeak = gettotalbytes(g);
+      break;
+    }
     case ILYA_GCPARAM: {
       int param = va_arg(argp, int);
       int value = va_arg(argp, int);
@@ -1274,6 +1343,43 @@ ILYA_API int ilya_next (ilya_State *L, int idx) {
 }
 
 
+ILYA_API int ilya_compacttable (ilya_State *L, int idx) {
+  Table *t;
+  int changed;
+  ilya_lock(L);
+  t = gettable(L, idx);
+  changed = ilyaH_shrink(L, t);
+  if (changed)
+    ilyaC_checkGC(L);
+  ilya_unlock(L);
+  return changed;
+}
+
+
+ILYA_API int ilya_sortnumbers (ilya_State *L, int idx, ilya_Integer n) {
+  Table *t;
+  int sorted;
+  ilya_lock(L);
+  t = gettable(L, idx);
+  sorted = (0 < n && n <= INT_MAX &&
+            ilyaH_sortnumbers(t, cast_uint(n)));
+  ilya_unlock(L);
+  return sorted;
+}
+
+
+ILYA_API ilya_Integer ilya_siftheap (ilya_State *L, int idx, ilya_Integer n,
+                                     ilya_Integer i, int up) {
+  Table *t;
+  ilya_lock(L);
+  t = gettable(L, idx);
+  if (0 < i && i <= n && n <= INT_MAX)
+    i = ilyaH_siftheap(L, t, cast_uint(n), cast_uint(i), up);
+  ilya_unlock(L);
+  return i;
+}
+
+
 ILYA_API void ilya_toclose (ilya_State *L, int idx) {
   StkId o;
   ilya_lock(L);
@@ -1328,6 +1434,68 @@ ILYA_API void ilya_setallocf (ilya_State *L, ilya_Alloc f, void *ud) {
 }
 
 
+/*
+** Set the maximum number of bytes the state may use (0 removes the
+** limit); returns the previous limit.
+*/
+ILYA_API size_t ilya_setmemlimit (ilya_State *L, size_t limit) {
+  global_State *g;
+  size_t old;
+  ilya_lock(L);
+  g = G(L);
+  old = cast_sizet(g->memlimit);
+  g->memlimit = (limit >= cast_sizet(MAX_LMEM)) ? MAX_LMEM : cast(l_mem, limit);
+  ilya_unlock(L);
+  return old;
+}
+
+
+/*
+** Return the maximum number of bytes in use so far; if 'reset' is
+** true, the peak restarts from the current use.
+*/
+ILYA_API size_t ilya_getmempeak (ilya_State *L, int reset) {
+  global_State *g;
+  size_t peak;
+  ilya_lock(L);
+  g = G(L);
+  peak = cast_sizet(g->mempeak);
+  if (reset)
+    g->mempeak = gettotalbytes(g);
+  ilya_unlock(L);
+  return peak;
+}
+
+
+/*
+** Count 'delta' bytes held outside Ilya's heap (e.g., buffers owned by
+** userdata) as if Ilya had allocated them, or freed them if 'delta' is
+** negative. A state cannot give back more than it was given.
+*/
+ILYA_API void ilya_gcadjust (ilya_State *L, ptrdiff_t delta) {
+  global_State *g;
+  l_mem d = cast(l_mem, delta);
+  ilya_lock(L);
+  g = G(L);
+  if (d < -g->GCexternal)
+    d = -g->GCexternal;
+  g->GCexternal += d;
+  g->GCdebt -= d;
+  if (d > 0)
+    ilyaC_checkGC(L);
+  ilya_unlock(L);
+}
+
+
+ILYA_API int ilya_internlimit (ilya_State *L, int limit) {
+  int res;
+  ilya_lock(L);
+  res = ilyaS_setshrlimit(L, limit);
+  ilya_unlock(L);
+  return res;
+}
+
+
 void ilya_setwarnf (ilya_State *L, ilya_WarnFunction f, void *ud) {
   ilya_lock(L);
   G(L)->ud_warn = ud;
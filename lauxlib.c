@@ -7,6 +7,10 @@
 #define lauxlib_c
 #define ILYA_LIB
 
+#if defined(ILYA_USE_LINUX) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE  /* for 'madvise' */
+#endif
+
 #include "lprefix.h"
 
 
@@ -1057,6 +1061,596 @@ static void *l_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
 }
 
 
+/*
+** {======================================================================
+** Slab allocator
+** =======================================================================
+*/
+
+#if !defined(ILYA_NOSLABS) && defined(ILYA_USE_POSIX)
+#define ILYA_SLABS
+#endif
+
+#if defined(ILYA_SLABS)	/* { */
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+/*
+** Blocks of up to SLABMAXSIZE bytes (most strings, tables, closures,
+** upvalues, etc.) are carved from slabs of SLABSIZE bytes, each slab
+** serving one size class (a multiple of SLABGRAIN). Each class
+** allocates from a "current" slab, first reusing its freed blocks
+** and then bumping a pointer through its never-used part; other slabs
+** of the class with free blocks wait in a list. Empty slabs go to a
+** list shared by all classes; when more than SLABKEEP + SLABBATCH of
+** them hold pages, all but SLABKEEP give their pages back to the OS.
+** Larger blocks go to 'realloc'.
+*/
+#define SLABSIZE	((size_t)1 << 16)  /* also the alignment of slabs */
+#define SLABGRAIN	16
+#define SLABMAXSIZE	256
+#define NCLASSES	(SLABMAXSIZE / SLABGRAIN)
+#define SLABKEEP	4
+#define SLABBATCH	8
+
+#define sizeclass(n)	((int)(((n) - 1) / SLABGRAIN))
+
+
+/* where a slab is */
+#define SCURRENT	0  /* current slab of its class */
+#define SPARTIAL	1  /* list of partial slabs of its class */
+#define SFULL		2  /* no list */
+#define SEMPTY		3  /* list of empty slabs */
+
+typedef struct Slab {
+  struct Slab *next;  /* next slab in its list */
+  struct Slab *prev;  /* previous slab in its list */
+  char *bump;  /* first never-used block */
+  void *freelist;  /* list of freed blocks */
+  unsigned int nlive;  /* number of blocks in use */
+  unsigned int size;  /* size of its blocks */
+  unsigned char where;
+  unsigned char released;  /* were its pages given back to the OS? */
+} Slab;
+
+
+/* offset of the first block in a slab (keeps blocks aligned) */
+#define SLABHEAD  ((sizeof(Slab) + SLABGRAIN - 1) & ~(size_t)(SLABGRAIN - 1))
+
+/* slab that would contain address 'p' */
+#define slabof(p)  ((Slab *)((L_P2I)(p) & ~(L_P2I)(SLABSIZE - 1)))
+
+#define slabend(s)	((char *)(s) + SLABSIZE)
+
+
+typedef struct SlabPool {
+  Slab *current[NCLASSES];  /* slab being used by each class */
+  Slab *partial[NCLASSES];  /* other slabs with free blocks */
+  Slab *empty;  /* list of empty slabs */
+  int nheld;  /* number of empty slabs still holding their pages */
+  size_t pagesize;  /* 0 if pages cannot be released */
+  Slab **set;  /* hash set (open addressing) with all slabs */
+  size_t sizeset;  /* size of 'set' (a power of 2) */
+  size_t nlive;  /* blocks in use (small and large) */
+  ilyaL_AllocStats stats;
+} SlabPool;
+
+
+/*
+** The allocator cannot trust 'osize' to tell slab blocks from large
+** ones, as Ilya uses it to pass a type tag for new blocks and an
+** allocation may have fallen back to 'malloc'; instead, it checks
+** whether the aligned address below a block is a known slab.
+*/
+static size_t slabhash (Slab *s, size_t size) {
+  return (size_t)((L_P2I)s / SLABSIZE) & (size - 1);
+}
+
+
+static void slabinsert (Slab **set, size_t size, Slab *s) {
+  size_t i = slabhash(s, size);
+  while (set[i] != NULL)
+    i = (i + 1) & (size - 1);
+  set[i] = s;
+}
+
+
+static int isslab (SlabPool *P, Slab *s) {
+  size_t i;
+  if (P->sizeset == 0)
+    return 0;
+  for (i = slabhash(s, P->sizeset); P->set[i] != NULL;
+       i = (i + 1) & (P->sizeset - 1)) {
+    if (P->set[i] == s)
+      return 1;
+  }
+  return 0;
+}
+
+
+/*
+** Register a new slab, growing the set to keep its load below 1/2.
+** (Slabs are only freed with the whole pool, so there are no
+** deletions.)
+*/
+static int addslab (SlabPool *P, Slab *s) {
+  if (2 * (P->stats.nslabs + 1) > P->sizeset) {
+    size_t nsize = (P->sizeset == 0) ? 16 : 2 * P->sizeset;
+    Slab **nset = (Slab **)calloc(nsize, sizeof(Slab *));
+    size_t i;
+    if (nset == NULL)
+      return 0;
+    for (i = 0; i < P->sizeset; i++) {
+      if (P->set[i] != NULL)
+        slabinsert(nset, nsize, P->set[i]);
+    }
+    free(P->set);
+    P->set = nset;
+    P->sizeset = nsize;
+  }
+  slabinsert(P->set, P->sizeset, s);
+  P->stats.nslabs++;
+  return 1;
+}
+
+
+static void slabunlink (Slab **list, Slab *s) {
+  if (s->prev != NULL)
+    s->prev->next = s->next;
+  else
+    *list = s->next;
+  if (s->next != NULL)
+    s->next->prev = s->prev;
+}
+
+
+static void slabpush (Slab **list, Slab *s, int where) {
+  s->prev = NULL;
+  s->next = *list;
+  if (*list != NULL)
+    (*list)->prev = s;
+  *list = s;
+  s->where = (unsigned char)where;
+}
+
+
+/*
+** Give back to the OS the pages of all empty slabs except the first
+** SLABKEEP ones (the most recently emptied). Each slab keeps its
+** first page, where its header lives; the others are refilled with
+** zeros by the OS if the slab is used again.
+*/
+static void releaseempty (SlabPool *P) {
+  Slab *s;
+  int n = 0;
+  for (s = P->empty; s != NULL; s = s->next) {
+    if (++n > SLABKEEP && !s->released) {
+      char *start = (char *)s + P->pagesize;
+#if defined(MADV_DONTNEED)
+      madvise(start, SLABSIZE - P->pagesize, MADV_DONTNEED);
+#else
+      posix_madvise(start, SLABSIZE - P->pagesize, POSIX_MADV_DONTNEED);
+#endif
+      s->released = 1;
+      P->nheld--;
+      P->stats.nreleased++;
+    }
+  }
+}
+
+
+/*
+** Make a new current slab for class 'c', taking it from the class'
+** partial slabs, from the empty slabs, or from the system, in that
+** order.
+*/
+static Slab *nextslab (SlabPool *P, int c) {
+  Slab *s = P->partial[c];
+  if (s != NULL)
+    slabunlink(&P->partial[c], s);
+  else {
+    if ((s = P->empty) != NULL) {
+      slabunlink(&P->empty, s);
+      if (!s->released)
+        P->nheld--;
+    }
+    else {
+      void *b;
+      if (posix_memalign(&b, SLABSIZE, SLABSIZE) != 0)
+        return NULL;
+      s = (Slab *)b;
+      if (!addslab(P, s)) {
+        free(b);
+        return NULL;
+      }
+    }
+    s->bump = (char *)s + SLABHEAD;
+    s->freelist = NULL;
+    s->nlive = 0;
+    s->size = (unsigned int)((c + 1) * SLABGRAIN);
+    s->released = 0;
+  }
+  if (P->current[c] != NULL)  /* old current slab is full */
+    P->current[c]->where = SFULL;
+  P->current[c] = s;
+  s->where = SCURRENT;
+  return s;
+}
+
+
+static void *slabget (SlabPool *P, int c) {
+  Slab *s = P->current[c];
+  void *b;
+  if (s == NULL || (s->freelist == NULL && s->bump + s->size > slabend(s))) {
+    s = nextslab(P, c);
+    if (s == NULL)
+      return NULL;
+  }
+  if (s->freelist != NULL) {  /* reuse a freed block? */
+    b = s->freelist;
+    s->freelist = *(void **)b;
+  }
+  else {  /* bump-pointer allocation */
+    b = s->bump;
+    s->bump += s->size;
+  }
+  s->nlive++;
+  P->stats.nalloc++;
+  return b;
+}
+
+
+static void slabput (SlabPool *P, Slab *s, void *b) {
+  int c = sizeclass(s->size);
+  *(void **)b = s->freelist;
+  s->freelist = b;
+  s->nlive--;
+  P->stats.nfree++;
+  if (s->where == SCURRENT)
+    return;  /* keep using it, even if empty */
+  else if (s->nlive == 0) {  /* slab became empty? */
+    if (s->where == SPARTIAL)
+      slabunlink(&P->partial[c], s);
+    slabpush(&P->empty, s, SEMPTY);
+    if (++P->nheld > SLABKEEP + SLABBATCH && P->pagesize != 0)
+      releaseempty(P);
+  }
+  else if (s->where == SFULL)  /* first block freed in a full slab? */
+    slabpush(&P->partial[c], s, SPARTIAL);
+}
+
+
+static SlabPool *newpool (void) {
+  SlabPool *P = (SlabPool *)calloc(1, sizeof(SlabPool));
+  if (P != NULL) {
+    long ps = sysconf(_SC_PAGESIZE);
+    if (ps >= (long)SLABHEAD && (size_t)ps < SLABSIZE)
+      P->pagesize = (size_t)ps;
+  }
+  return P;
+}
+
+
+static void freepool (SlabPool *P) {
+  size_t i;
+  for (i = 0; i < P->sizeset; i++)
+    free(P->set[i]);  /* free(NULL) is a no-op */
+  free(P->set);
+  free(P);
+}
+
+
+/*
+** A pool lives while it has blocks in use; it is freed together with
+** the last one, which is the state itself when the state is closed.
+** Shrinking a block never fails: a slab block stays where it is and
+** a large block that cannot move to a slab is shrunk by 'realloc'
+** (keeping the original block if even that fails).
+*/
+static void *slab_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
+  SlabPool *P = (SlabPool *)ud;
+  Slab *s = (ptr != NULL && isslab(P, slabof(ptr))) ? slabof(ptr) : NULL;
+  void *nptr;
+  if (nsize == 0) {
+    if (ptr != NULL) {
+      if (s != NULL)
+        slabput(P, s, ptr);
+      else
+        free(ptr);
+      if (--P->nlive == 0)
+        freepool(P);
+    }
+    return NULL;
+  }
+  else if (s != NULL && nsize <= s->size)
+    return ptr;  /* block still fits in its slab */
+  nptr = (nsize <= SLABMAXSIZE) ? slabget(P, sizeclass(nsize)) : NULL;
+  if (nptr == NULL) {  /* large block (or no slab available)? */
+    if (s == NULL) {  /* old block (if any) is large too? */
+      nptr = realloc(ptr, nsize);
+      if (nptr == NULL)
+        return (ptr != NULL && nsize <= osize) ? ptr : NULL;
+      if (ptr == NULL)
+        P->nlive++;
+      P->stats.nlarge++;
+      return nptr;
+    }
+    nptr = malloc(nsize);
+    if (nptr == NULL)
+      return NULL;
+    P->stats.nlarge++;
+  }
+  if (ptr == NULL)
+    P->nlive++;
+  else {  /* move old block */
+    size_t oldsize = (s != NULL) ? s->size : osize;
+    memcpy(nptr, ptr, (oldsize < nsize) ? oldsize : nsize);
+    if (s != NULL)
+      slabput(P, s, ptr);
+    else
+      free(ptr);
+  }
+  return nptr;
+}
+
+
+/*
+** Create a state using a new pool. The pool holds an extra count
+** while 'ilya_newstate' runs, so that it is freed here (and only
+** here) if the state cannot be created.
+*/
+static ilya_State *newslabstate (unsigned int seed) {
+  SlabPool *P = newpool();
+  ilya_State *L;
+  if (P == NULL)
+    return NULL;
+  P->nlive = 1;
+  L = ilya_newstate(slab_alloc, P, seed);
+  if (--P->nlive == 0)
+    freepool(P);
+  return L;
+}
+
+#endif			/* } */
+
+
+ILYALIB_API int ilyaL_allocstats (ilya_State *L, ilyaL_AllocStats *st) {
+#if defined(ILYA_SLABS)
+  void *ud;
+  if (ilya_getallocf(L, &ud) == slab_alloc) {
+    *st = ((SlabPool *)ud)->stats;
+    return 1;
+  }
+#endif
+  (void)L; (void)st;  /* not used */
+  return 0;
+}
+
+/* }====================================================================== */
+
+
+/*
+** {======================================================================
+** Arena allocator
+** Memory comes from chunks that are freed all together, when the
+** state's main block (its first block) is freed. Blocks freed before
+** that go to per-class free lists for reuse; small sizes are rounded
+** to multiples of ARENAGRAIN, others up to ARENABIG to powers of 2.
+** Larger blocks get their own 'malloc' block, linked in a list so
+** that they can also be freed one by one.
+** =======================================================================
+*/
+
+#define ARENAGRAIN	16
+#define ARENASMALL	256
+#define ARENABIG	((size_t)1 << 15)
+#define ARENAMINCHUNK	((size_t)1 << 14)
+#define ARENAMAXCHUNK	((size_t)1 << 20)
+
+#define NARENASMALL	(ARENASMALL / ARENAGRAIN)
+/* small classes plus powers of 2 from 2 * ARENASMALL to ARENABIG */
+#define NARENACLASSES	(NARENASMALL + 7)
+
+
+/* header of chunks and large blocks */
+typedef union ArenaHead {
+  struct {
+    union ArenaHead *prev;  /* (used only by large blocks) */
+    union ArenaHead *next;
+  } h;
+  ILYAI_MAXALIGN;
+} ArenaHead;
+
+
+typedef struct Arena {
+  char *bump;  /* free part of the current chunk */
+  char *limit;  /* end of the current chunk */
+  size_t chunksize;  /* size for the next chunk */
+  ArenaHead *chunks;  /* list of chunks */
+  ArenaHead *big;  /* list of large blocks */
+  void *mainblock;  /* block whose release frees the arena */
+  int held;  /* true while the state is being created */
+  void *freelist[NARENACLASSES];
+} Arena;
+
+
+static int arenaclass (size_t n) {
+  if (n <= ARENASMALL)
+    return (int)((n - 1) / ARENAGRAIN);
+  else {
+    int c = NARENASMALL;
+    size_t s = 2 * ARENASMALL;
+    while (s < n) {
+      s <<= 1;
+      c++;
+    }
+    return c;
+  }
+}
+
+
+static size_t arenasize (int c) {
+  return (c < NARENASMALL) ? (size_t)(c + 1) * ARENAGRAIN
+                           : (size_t)ARENASMALL << (c - NARENASMALL + 1);
+}
+
+
+static void *arenaget (Arena *A, int c) {
+  size_t size = arenasize(c);
+  void *b = A->freelist[c];
+  if (b != NULL) {  /* reuse a freed block? */
+    A->freelist[c] = *(void **)b;
+    return b;
+  }
+  if ((size_t)(A->limit - A->bump) < size) {  /* need a new chunk? */
+    size_t csize = A->chunksize;
+    ArenaHead *ch;
+    if (csize < sizeof(ArenaHead) + size)
+      csize = sizeof(ArenaHead) + size;
+    ch = (ArenaHead *)malloc(csize);
+    if (ch == NULL)
+      return NULL;
+    ch->h.next = A->chunks;
+    A->chunks = ch;
+    A->bump = (char *)(ch + 1);
+    A->limit = (char *)ch + csize;
+    if (A->chunksize < ARENAMAXCHUNK)
+      A->chunksize *= 2;  /* larger arenas get larger chunks */
+  }
+  b = A->bump;
+  A->bump += size;
+  return b;
+}
+
+
+static void biglink (Arena *A, ArenaHead *h) {
+  h->h.prev = NULL;
+  h->h.next = A->big;
+  if (A->big != NULL)
+    A->big->h.prev = h;
+  A->big = h;
+}
+
+
+static void bigunlink (Arena *A, ArenaHead *h) {
+  if (h->h.prev != NULL)
+    h->h.prev->h.next = h->h.next;
+  else
+    A->big = h->h.next;
+  if (h->h.next != NULL)
+    h->h.next->h.prev = h->h.prev;
+}
+
+
+/* allocate or resize a large block (either 'ptr' is NULL or large) */
+static void *bigrealloc (Arena *A, void *ptr, size_t nsize) {
+  ArenaHead *h = (ptr != NULL) ? (ArenaHead *)ptr - 1 : NULL;
+  ArenaHead *nh;
+  if (h != NULL)
+    bigunlink(A, h);
+  nh = (ArenaHead *)realloc(h, sizeof(ArenaHead) + nsize);
+  if (nh == NULL) {
+    if (h != NULL)
+      biglink(A, h);  /* old block is still valid */
+    return NULL;
+  }
+  biglink(A, nh);
+  return nh + 1;
+}
+
+
+static void arenaput (Arena *A, void *b, size_t size) {
+  if (size > ARENABIG) {
+    ArenaHead *h = (ArenaHead *)b - 1;
+    bigunlink(A, h);
+    free(h);
+  }
+  else {
+    int c = arenaclass(size);
+    *(void **)b = A->freelist[c];
+    A->freelist[c] = b;
+  }
+}
+
+
+static void freearena (Arena *A) {
+  while (A->chunks != NULL) {
+    ArenaHead *ch = A->chunks;
+    A->chunks = ch->h.next;
+    free(ch);
+  }
+  while (A->big != NULL) {
+    ArenaHead *h = A->big;
+    A->big = h->h.next;
+    free(h);
+  }
+  free(A);
+}
+
+
+/*
+** Turn the large block 'b' into a chunk. A large block that cannot
+** move when shrinking into a small class must leave the list of large
+** blocks: when released, it goes to a free list, and its memory is
+** freed with the other chunks.
+*/
+static void bigtochunk (Arena *A, void *b) {
+  ArenaHead *h = (ArenaHead *)b - 1;
+  bigunlink(A, h);
+  h->h.next = A->chunks;
+  A->chunks = h;
+}
+
+
+/*
+** A block keeps its place while its class does not change; shrinking
+** into a smaller class never fails, as the block stays in place if it
+** cannot move. (A block kept that way later goes to the free list of
+** its new, smaller, class.)
+*/
+static void *arena_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
+  Arena *A = (Arena *)ud;
+  void *nptr;
+  if (ptr == NULL)
+    osize = 0;  /* 'osize' is a type tag */
+  if (nsize == 0) {
+    if (ptr == NULL)
+      return NULL;
+    else if (ptr != A->mainblock)
+      arenaput(A, ptr, osize);
+    else if (!A->held)
+      freearena(A);  /* state is gone: release everything */
+    return NULL;
+  }
+  else if (osize > ARENABIG && nsize > ARENABIG) {  /* large to large? */
+    nptr = bigrealloc(A, ptr, nsize);
+    return (nptr == NULL && nsize <= osize) ? ptr : nptr;
+  }
+  else if (ptr != NULL && osize <= ARENABIG && nsize <= ARENABIG &&
+           arenaclass(nsize) == arenaclass(osize))
+    return ptr;  /* same class */
+  nptr = (nsize <= ARENABIG) ? arenaget(A, arenaclass(nsize))
+                             : bigrealloc(A, NULL, nsize);
+  if (nptr == NULL) {
+    if (ptr == NULL || nsize > osize)
+      return NULL;
+    if (osize > ARENABIG)  /* large block shrinking into a class? */
+      bigtochunk(A, ptr);
+    return ptr;  /* keep it in place */
+  }
+  if (ptr != NULL) {  /* move old block */
+    memcpy(nptr, ptr, (osize < nsize) ? osize : nsize);
+    arenaput(A, ptr, osize);
+  }
+  else if (A->mainblock == NULL)
+    A->mainblock = nptr;  /* first block is the state's main block */
+  return nptr;
+}
+
+/* }====================================================================== */
+
+
 /*
 ** Standard panic fn just prints an error message. The test
 ** with 'ilya_type' avoids possible memory errors in 'ilya_tostring'.
@@ -1177,8 +1771,7 @@ ILYALIB_API unsigned int ilyaL_makeseed (ilya_State *L) {
 }
 
 
-ILYALIB_API ilya_State *ilyaL_newstate (void) {
-  ilya_State *L = ilya_newstate(l_alloc, NULL, ilyai_makeseed());
+static ilya_State *setdefaults (ilya_State *L) {
   if (l_likely(L)) {
     ilya_atpanic(L, &panic);
     ilya_setwarnf(L, warnfoff, L);  /* default is warnings off */
@@ -1187,6 +1780,42 @@ ILYALIB_API ilya_State *ilyaL_newstate (void) {
 }
 
 
+ILYALIB_API ilya_State *ilyaL_newstate (void) {
+  ilya_State *L = ilya_newstate(l_alloc, NULL, ilyai_makeseed());
+  return setdefaults(L);
+}
+
+
+ILYALIB_API ilya_State *ilyaL_newslabstate (void) {
+  ilya_State *L = NULL;
+#if defined(ILYA_SLABS)
+  L = newslabstate(ilyai_makeseed());
+#endif
+  if (L == NULL)  /* no slabs? */
+    L = ilya_newstate(l_alloc, NULL, ilyai_makeseed());
+  return setdefaults(L);
+}
+
+
+/*
+** The arena is held while the state is created, so that it is freed
+** here (and only here) if creation fails.
+*/
+ILYALIB_API ilya_State *ilyaL_newarena (void) {
+  Arena *A = (Arena *)calloc(1, sizeof(Arena));
+  ilya_State *L;
+  if (A == NULL)
+    return NULL;
+  A->chunksize = ARENAMINCHUNK;
+  A->held = 1;
+  L = ilya_newarena(arena_alloc, A, ilyai_makeseed());
+  A->held = 0;
+  if (L == NULL)
+    freearena(A);
+  return setdefaults(L);
+}
+
+
 ILYALIB_API void ilyaL_checkversion_ (ilya_State *L, ilya_Number ver, size_t sz) {
   ilya_Number v = ilya_version(L);
   if (sz != ILYAL_NUMSIZES)  /* check numeric types */
@@ -99,6 +99,19 @@ ILYALIB_API int (ilyaL_loadbufferx) (ilya_State *L, const char *buff, size_t sz,
 ILYALIB_API int (ilyaL_loadstring) (ilya_State *L, const char *s);
 
 ILYALIB_API ilya_State *(ilyaL_newstate) (void);
+ILYALIB_API ilya_State *(ilyaL_newslabstate) (void);
+ILYALIB_API ilya_State *(ilyaL_newarena) (void);
+
+/* counters of the slab allocator used by 'ilyaL_newslabstate' */
+typedef struct ilyaL_AllocStats {
+  size_t nalloc;  /* blocks allocated from slabs */
+  size_t nfree;  /* blocks returned to slabs */
+  size_t nlarge;  /* requests passed to 'realloc'/'malloc' */
+  size_t nslabs;  /* slabs obtained from the system */
+  size_t nreleased;  /* times an empty slab gave its pages back */
+} ilyaL_AllocStats;
+
+ILYALIB_API int (ilyaL_allocstats) (ilya_State *L, ilyaL_AllocStats *st);
 
 ILYALIB_API unsigned ilyaL_makeseed (ilya_State *L);
 
@@ -188,7 +188,55 @@ static int pushmode (ilya_State *L, int oldmode) {
     ilyaL_pushfail(L);  /* invalid call to 'ilya_gc' */
   else
     ilya_pushstring(L, (oldmode == ILYA_GCINC) ? "incremental"
-                                             : "generational");
+                     : (oldmode == ILYA_GCAUTO) ? "auto" : "generational");
+  return 1;
+}
+
+
+static int pushstats (ilya_State *L) {
+  static const char *const fields[] = {"minor", "major", "incremental",
+    "minorwork", "majorwork", "incwork", "survival", "switches"};
+  static const char *const decisions[] = {"none", "incremental",
+    "generational", "minormul", "minormajor", "majorminor"};
+  int i;
+  if (ilya_gc(L, ILYA_GCSTAT, ILYA_GCSMINOR) == -1) {
+    ilyaL_pushfail(L);  /* invalid call to 'ilya_gc' */
+    return 1;
+  }
+  ilya_createtable(L, ILYA_GCSNPAUSES, 10);
+  for (i = 0; i <= ILYA_GCSSWITCHES; i++) {
+    int v = ilya_gc(L, ILYA_GCSTAT, i);
+    if (i == ILYA_GCSSURVIVAL && v < 0)  /* unknown survival rate? */
+      continue;  /* leave it absent */
+    ilya_pushinteger(L, v);
+    ilya_setfield(L, -2, fields[i]);
+  }
+  ilya_pushstring(L, decisions[ilya_gc(L, ILYA_GCSTAT, ILYA_GCSDECISION)]);
+  ilya_setfield(L, -2, "decision");
+  for (i = 0; i < ILYA_GCSNPAUSES; i++) {
+    ilya_pushinteger(L, ilya_gc(L, ILYA_GCSTAT, ILYA_GCSPAUSES + i));
+    ilya_rawseti(L, -2, i + 1);
+  }
+  return 1;
+}
+
+
+/* 'collectgarbage' option that does not go through 'ilya_gc' */
+#define GCOPTBYTYPE	100
+
+
+static int pushbytype (ilya_State *L) {
+  size_t bytes[ILYA_NUMMEMTYPES];
+  int i;
+  ilya_typememory(L, bytes);
+  ilya_createtable(L, 0, ILYA_NUMMEMTYPES);
+  for (i = 0; i < ILYA_NUMMEMTYPES; i++) {
+    if (bytes[i] > 0) {
+      ilya_pushinteger(L, (ilya_Integer)bytes[i]);
+      ilya_setfield(L, -2, (i < ILYA_NUMTYPES) ? ilya_typename(L, i)
+                         : (i == ILYA_NUMTYPES) ? "upvalue" : "proto");
+    }
+  }
   return 1;
 }
 
@@ -201,10 +249,11 @@ static int pushmode (ilya_State *L, int oldmode) {
 static int ilyaB_collectgarbage (ilya_State *L) {
   static const char *const opts[] = {"stop", "restart", "collect",
     "count", "step", "isrunning", "generational", "incremental",
-    "param", NULL};
+    "param", "auto", "stats", "limit", "peak", "bytype", NULL};
   static const char optsnum[] = {ILYA_GCSTOP, ILYA_GCRESTART, ILYA_GCCOLLECT,
     ILYA_GCCOUNT, ILYA_GCSTEP, ILYA_GCISRUNNING, ILYA_GCGEN, ILYA_GCINC,
-    ILYA_GCPARAM};
+    ILYA_GCPARAM, ILYA_GCAUTO, ILYA_GCSTAT, ILYA_GCLIMIT, ILYA_GCPEAK,
+    GCOPTBYTYPE};
   int o = optsnum[ilyaL_checkoption(L, 1, "collect", opts)];
   switch (o) {
     case ILYA_GCCOUNT: {
@@ -233,6 +282,30 @@ static int ilyaB_collectgarbage (ilya_State *L) {
     case ILYA_GCINC: {
       return pushmode(L, ilya_gc(L, o));
     }
+    case ILYA_GCAUTO: {
+      return pushmode(L, ilya_gc(L, o));
+    }
+    case ILYA_GCSTAT: {
+      return pushstats(L);
+    }
+    case GCOPTBYTYPE: {
+      return pushbytype(L);
+    }
+    case ILYA_GCLIMIT: {
+      ilya_Integer kb = ilyaL_optinteger(L, 2, -1);
+      int res;
+      ilyaL_argcheck(L, -1 <= kb && kb <= INT_MAX, 2, "limit out of range");
+      res = ilya_gc(L, o, (int)kb);
+      checkvalres(res);
+      ilya_pushinteger(L, res);
+      return 1;
+    }
+    case ILYA_GCPEAK: {
+      int res = ilya_gc(L, o, ilya_toboolean(L, 2));
+      checkvalres(res);
+      ilya_pushinteger(L, res);
+      return 1;
+    }
     case ILYA_GCPARAM: {
       static const char *const params[] = {
         "minormul", "majorminor", "minormajor",
@@ -168,6 +168,13 @@ static int ilyaB_corunning (ilya_State *L) {
 }
 
 
+static int ilyaB_comemory (ilya_State *L) {
+  ilya_State *co = ilya_isnone(L, 1) ? L : getco(L);
+  ilya_pushinteger(L, (ilya_Integer)ilya_threadmemory(L, co));
+  return 1;
+}
+
+
 static int ilyaB_close (ilya_State *L) {
   ilya_State *co = getco(L);
   int status = auxstatus(L, co);
@@ -199,6 +206,7 @@ static const ilyaL_Reg co_funcs[] = {
   {"yield", ilyaB_yield},
   {"isyieldable", ilyaB_yieldable},
   {"close", ilyaB_close},
+  {"memory", ilyaB_comemory},
   {NULL, NULL}
 };
 
@@ -420,6 +420,60 @@ static int db_gethook (ilya_State *L) {
 }
 
 
+static int db_memprofile (ilya_State *L) {
+  ilya_Integer rate = ilyaL_optinteger(L, 1, -1);
+  ilyaL_argcheck(L, rate <= INT_MAX, 1, "rate too large");
+  ilya_pushinteger(L, ilya_memprofile(L, (rate < 0) ? -1 : (int)rate));
+  return 1;
+}
+
+
+static int db_memaccount (ilya_State *L) {
+  int on = ilya_isnoneornil(L, 1) ? -1 : ilya_toboolean(L, 1);
+  ilya_pushboolean(L, ilya_memaccount(L, on));
+  return 1;
+}
+
+
+static int reportwriter (ilya_State *L, const void *b, size_t size,
+                                       void *ud) {
+  (void)L;  /* not used */
+  ilyaL_addlstring((ilyaL_Buffer *)ud, (const char *)b, size);
+  return 0;
+}
+
+
+static int db_memreport (ilya_State *L) {
+  static const char *const opts[] = {"live", "total", NULL};
+  static const int optsnum[] = {ILYA_MEMLIVE, ILYA_MEMTOTAL};
+  int what = optsnum[ilyaL_checkoption(L, 1, "live", opts)];
+  ilyaL_Buffer b;
+  ilyaL_buffinit(L, &b);
+  ilya_memreport(L, what, reportwriter, &b);
+  ilyaL_pushresult(&b);
+  return 1;
+}
+
+
+static int snapwriter (ilya_State *L, const void *b, size_t size,
+                                     void *ud) {
+  (void)L;  /* not used */
+  return (fwrite(b, 1, size, (FILE *)ud) != size);
+}
+
+
+static int db_heapsnapshot (ilya_State *L) {
+  const char *fname = ilyaL_checkstring(L, 1);
+  FILE *f = fopen(fname, "w");
+  int res;
+  if (f == NULL)
+    return ilyaL_fileresult(L, 0, fname);
+  res = (ilya_heapsnapshot(L, snapwriter, f) == 0);
+  res = (fclose(f) == 0) && res;
+  return ilyaL_fileresult(L, res, fname);
+}
+
+
 static int db_debug (ilya_State *L) {
   for (;;) {
     char buffer[250];
@@ -458,6 +512,10 @@ static const ilyaL_Reg dblib[] = {
   {"getregistry", db_getregistry},
   {"getmetatable", db_getmetatable},
   {"getupvalue", db_getupvalue},
+  {"heapsnapshot", db_heapsnapshot},
+  {"memaccount", db_memaccount},
+  {"memprofile", db_memprofile},
+  {"memreport", db_memreport},
   {"upvaluejoin", db_upvaluejoin},
   {"upvalueid", db_upvalueid},
   {"setuservalue", db_setuservalue},
@@ -21,6 +21,7 @@
 #include "ldebug.h"
 #include "ldo.h"
 #include "lfunc.h"
+#include "lmem.h"
 #include "lobject.h"
 #include "lopcodes.h"
 #include "lstate.h"
@@ -157,6 +158,66 @@ ILYA_API int ilya_gethookcount (ilya_State *L) {
 }
 
 
+ILYA_API int ilya_memprofile (ilya_State *L, int rate) {
+  int oldrate;
+  ilya_lock(L);
+  oldrate = ilyaM_setprofile(L, rate);
+  ilya_unlock(L);
+  return oldrate;
+}
+
+
+ILYA_API int ilya_memreport (ilya_State *L, int what, ilya_Writer writer,
+                                                    void *data) {
+  int status;
+  ilya_lock(L);
+  api_check(L, what == ILYA_MEMLIVE || what == ILYA_MEMTOTAL,
+               "invalid report option");
+  status = ilyaM_profreport(L, what, writer, data);
+  ilya_unlock(L);
+  return status;
+}
+
+
+ILYA_API int ilya_heapsnapshot (ilya_State *L, ilya_Writer writer,
+                                             void *data) {
+  int status;
+  ilya_lock(L);
+  status = ilyaC_heapsnapshot(L, writer, data);
+  ilya_unlock(L);
+  return status;
+}
+
+
+ILYA_API int ilya_memaccount (ilya_State *L, int on) {
+  int old;
+  ilya_lock(L);
+  old = ilyaM_setaccount(L, on);
+  ilya_unlock(L);
+  return old;
+}
+
+
+ILYA_API void ilya_typememory (ilya_State *L, size_t *bytes) {
+  l_mem b[ILYA_NUMMEMTYPES];
+  int i;
+  ilya_lock(L);
+  ilyaC_typememory(L, b);
+  ilya_unlock(L);
+  for (i = 0; i < ILYA_NUMMEMTYPES; i++)
+    bytes[i] = cast_sizet(b[i]);
+}
+
+
+ILYA_API size_t ilya_threadmemory (ilya_State *L, ilya_State *co) {
+  l_mem res;
+  ilya_lock(L);
+  res = ilyaC_threadmemory(L, co);
+  ilya_unlock(L);
+  return cast_sizet(res);
+}
+
+
 ILYA_API int ilya_getstack (ilya_State *L, int level, ilya_Debug *ar) {
   int status;
   CallInfo *ci;
@@ -9,11 +9,13 @@
 
 #include "lprefix.h"
 
+#include <stdio.h>
 #include <string.h>
 
 
 #include "ilya.h"
 
+#include "lapi.h"
 #include "ldebug.h"
 #include "ldo.h"
 #include "lfunc.h"
@@ -24,6 +26,7 @@
 #include "lstring.h"
 #include "ltable.h"
 #include "ltm.h"
+#include "lvm.h"
 
 
 /*
@@ -34,6 +37,12 @@
 #define GCSWEEPMAX	20
 
 
+/*
+** Maximum number of table slots traversed in each single step.
+*/
+#define GCTRAVMAX	1024
+
+
 /*
 ** Cost (in work units) of running one finalizer.
 */
@@ -97,6 +106,270 @@ static void atomic (ilya_State *L);
 static void entersweep (ilya_State *L);
 
 
+/*
+** {======================================================
+** Card marking
+** =======================================================
+*/
+
+/*
+** In minor collections, a back barrier on an old table makes the
+** collector traverse the whole table again, which is a waste for large
+** tables where the program writes a few entries at a time. So, a large
+** strong table gets a card set: the array part is divided in cards of
+** 2^CARDBITS slots, each with its own dirty bits, and the barrier only
+** marks the card of the written slot, leaving the table black. The hash
+** part has a single card (the last one), because inserting a key can
+** move other nodes around without any barrier. A traversal in a minor
+** collection visits only the dirty cards. A card written in the current
+** cycle (CARDCUR) must be visited in this collection and also in the
+** next one (CARDPREV), mirroring the ages TOUCHED1 and TOUCHED2 of the
+** table. Card sets live in 'g->cardsets', an open-addressing hash
+** indexed by the table address, and they only exist in minor mode.
+*/
+
+/* log2 of the number of array slots in a card */
+#define CARDBITS	7
+
+/* minimum array size for a table to get a card set */
+#define CARDMINSLOTS	(8u << CARDBITS)
+
+/* card bits */
+#define CARDCUR		1  /* card written in the current cycle */
+#define CARDPREV	2  /* card written in the previous cycle */
+
+
+typedef struct CardSet {
+  Table *t;  /* owner of the cards */
+  unsigned int asize;  /* size of its array part when cards were created */
+  unsigned int ncards;  /* number of cards (including the hash card) */
+  lu_byte cards[1];  /* card bits (actual size is 'ncards') */
+} CardSet;
+
+#define sizecardset(n)	(offsetof(CardSet, cards) + (n) * sizeof(lu_byte))
+
+/* index of the card for the hash part */
+#define hashcard(cs)	((cs)->ncards - 1)
+
+
+static unsigned int cardhash (const Table *t, int size) {
+  unsigned int h = point2uint(t);
+  return (h ^ (h >> 11)) & cast_uint(size - 1);
+}
+
+
+/*
+** Returns the slot in 'g->cardsets' holding the card set of table 't',
+** which must have one.
+*/
+static CardSet **findcards (global_State *g, const Table *t) {
+  unsigned int mask = cast_uint(g->sizecardsets - 1);
+  unsigned int i = cardhash(t, g->sizecardsets);
+  ilya_assert(hascards(t));
+  for (;;) {
+    ilya_assert(g->cardsets[i] != NULL);
+    if (g->cardsets[i]->t == t)
+      return &g->cardsets[i];
+    i = (i + 1) & mask;
+  }
+}
+
+
+/*
+** Card sets are created inside barriers, which cannot raise errors nor
+** run emergency collections. So, allocation here just fails, and the
+** caller falls back to a regular barrier.
+*/
+static void *cardalloc (ilya_State *L, size_t size) {
+  global_State *g = G(L);
+  lu_byte oldstopem = g->gcstopem;
+  void *block;
+  g->gcstopem = 1;  /* avoid emergency collections */
+  block = ilyaM_realloc_(L, NULL, 0, size);
+  g->gcstopem = oldstopem;
+  return block;
+}
+
+
+static void insertcards (global_State *g, CardSet *cs) {
+  unsigned int mask = cast_uint(g->sizecardsets - 1);
+  unsigned int i = cardhash(cs->t, g->sizecardsets);
+  while (g->cardsets[i] != NULL)
+    i = (i + 1) & mask;
+  g->cardsets[i] = cs;
+}
+
+
+static int growcardsets (ilya_State *L, global_State *g) {
+  int oldsize = g->sizecardsets;
+  CardSet **old = g->cardsets;
+  int size = (oldsize > 0) ? 2 * oldsize : 8;
+  int i;
+  CardSet **nh;
+  nh = cast(CardSet **, cardalloc(L, cast_sizet(size) * sizeof(CardSet *)));
+  if (nh == NULL)
+    return 0;
+  for (i = 0; i < size; i++)
+    nh[i] = NULL;
+  g->cardsets = nh;
+  g->sizecardsets = size;
+  for (i = 0; i < oldsize; i++) {
+    if (old[i] != NULL)
+      insertcards(g, old[i]);
+  }
+  ilyaM_freearray(L, old, cast_sizet(oldsize));
+  return 1;
+}
+
+
+/*
+** Removes the card set at slot 'p' (closing the gap, so that lookups
+** do not need tombstones) and frees it.
+*/
+static void deletecards (ilya_State *L, CardSet **p) {
+  global_State *g = G(L);
+  unsigned int mask = cast_uint(g->sizecardsets - 1);
+  unsigned int i = cast_uint(p - g->cardsets);
+  unsigned int j = i;
+  CardSet *cs = *p;
+  g->cardsets[i] = NULL;
+  for (;;) {
+    unsigned int k;
+    j = (j + 1) & mask;
+    if (g->cardsets[j] == NULL)
+      break;
+    k = cardhash(g->cardsets[j]->t, g->sizecardsets);
+    /* can entry 'j' move back to 'i'? (is 'k' cyclically out of (i, j]?) */
+    if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j))
+      continue;
+    g->cardsets[i] = g->cardsets[j];
+    g->cardsets[j] = NULL;
+    i = j;
+  }
+  cs->t->flags &= cast_byte(~BITCARDS);
+  ilyaM_freemem(L, cs, sizecardset(cs->ncards));
+  g->ncardsets--;
+}
+
+
+static CardSet *newcards (ilya_State *L, Table *t, lu_byte init) {
+  global_State *g = G(L);
+  unsigned int ncards = ((t->asize + (1u << CARDBITS) - 1) >> CARDBITS) + 1;
+  CardSet *cs;
+  if (2 * (g->ncardsets + 1) > g->sizecardsets && !growcardsets(L, g))
+    return NULL;
+  cs = cast(CardSet *, cardalloc(L, sizecardset(ncards)));
+  if (cs == NULL)
+    return NULL;
+  cs->t = t;
+  cs->asize = t->asize;
+  cs->ncards = ncards;
+  memset(cs->cards, init, ncards);
+  insertcards(g, cs);
+  g->ncardsets++;
+  t->flags |= BITCARDS;
+  return cs;
+}
+
+
+/*
+** Returns the card set of table 't', creating it if needed, or NULL
+** if it cannot be created. Any card in a new set of a touched table
+** may hold young objects, so all of them start dirty.
+*/
+static CardSet *getcards (ilya_State *L, Table *t) {
+  if (hascards(t)) {
+    CardSet *cs = *findcards(G(L), t);
+    ilya_assert(cs->asize == t->asize);
+    return cs;
+  }
+  return newcards(L, t, (getage(t) == G_OLD) ? 0 : CARDCUR | CARDPREV);
+}
+
+
+/*
+** Frees the card set of table 't', whose array part was resized. Its
+** cards no longer match the array slots; the table will be traversed
+** entirely until a barrier creates a new set. A table kept black by
+** its cards becomes a regular (gray) 'touched1' object; it is already
+** in 'grayagain'.
+*/
+void ilyaC_dropcards (ilya_State *L, Table *t) {
+  deletecards(L, findcards(G(L), t));
+  if (isblack(t) && getage(t) == G_TOUCHED1)
+    set2gray(t);
+}
+
+
+/*
+** Marks all cards of 't' as written in the current cycle.
+*/
+static void dirtycards (global_State *g, Table *t) {
+  CardSet *cs = *findcards(g, t);
+  unsigned int i;
+  for (i = 0; i < cs->ncards; i++)
+    cs->cards[i] |= CARDCUR;
+}
+
+
+/*
+** Frees all card sets (when leaving minor mode).
+*/
+static void freeallcards (ilya_State *L, global_State *g) {
+  int i;
+  for (i = 0; i < g->sizecardsets; i++) {
+    CardSet *cs = g->cardsets[i];
+    if (cs != NULL) {
+      cs->t->flags &= cast_byte(~BITCARDS);
+      ilyaM_freemem(L, cs, sizecardset(cs->ncards));
+    }
+  }
+  ilyaM_freearray(L, g->cardsets, cast_sizet(g->sizecardsets));
+  g->cardsets = NULL;
+  g->ncardsets = g->sizecardsets = 0;
+}
+
+
+/*
+** Barrier for the black table 't' getting a white value with key 'key'.
+** In minor mode, a large strong old table only marks the card of the
+** written entry and stays black, linked in 'grayagain' to be traversed
+** in the next collection. Everything else gets a regular back barrier.
+*/
+void ilyaC_barriertable_ (ilya_State *L, Table *t, const TValue *key) {
+  global_State *g = G(L);
+  int age = getage(t);
+  ilya_assert(isblack(t) && !isdead(g, t));
+  if (g->gckind == KGC_GENMINOR &&
+      (age == G_OLD || age == G_TOUCHED1 || age == G_TOUCHED2) &&
+      t->asize >= CARDMINSLOTS &&
+      gfasttm(g, t->metatable, TM_MODE) == NULL) {
+    CardSet *cs = getcards(L, t);
+    if (cs != NULL) {
+      ilya_Integer k = 0;  /* 0 if key cannot be in the array part */
+      if (ttisinteger(key))
+        k = ivalue(key);
+      else if (ttisfloat(key))  /* may be stored as an integer */
+        ilyaV_flttointeger(fltvalue(key), &k, F2Ieq);
+      if (l_castS2U(k) - 1u < t->asize)
+        cs->cards[cast_uint(k - 1) >> CARDBITS] |= CARDCUR;
+      else
+        cs->cards[hashcard(cs)] |= CARDCUR;
+      if (age == G_OLD) {  /* not in a gray list yet? */
+        t->gclist = g->grayagain;  /* link it, keeping it black */
+        g->grayagain = obj2gco(t);
+      }
+      setage(t, G_TOUCHED1);
+      return;
+    }
+  }
+  ilyaC_barrierback_(L, obj2gco(t));
+}
+
+/* }====================================================== */
+
+
+
 /*
 ** {======================================================
 ** Generic functions
@@ -105,9 +378,12 @@ static void entersweep (ilya_State *L);
 
 
 /*
-** one after last element in a hash array
+** Node 'i' of the hash part of table 'h', counting first the 'osize'
+** nodes of an old hash part 'old' still being moved into it (see
+** 'ilyaH_oldnodes').
 */
-#define gnodelast(h)	gnode(h, cast_sizet(sizenode(h)))
+#define hashnode(h,old,osize,i)  \
+	((i) < (osize) ? (old) + (i) : gnode(h, (i) - (osize)))
 
 
 static l_mem objsize (GCObject *o) {
@@ -268,10 +544,15 @@ void ilyaC_barrier_ (ilya_State *L, GCObject *o, GCObject *v) {
 */
 void ilyaC_barrierback_ (ilya_State *L, GCObject *o) {
   global_State *g = G(L);
+  int cards = (o->tt == ILYA_VTABLE && hascards(gco2t(o)));
   ilya_assert(isblack(o) && !isdead(g, o));
   ilya_assert((g->gckind != KGC_GENMINOR)
-          || (isold(o) && getage(o) != G_TOUCHED1));
-  if (getage(o) == G_TOUCHED2)  /* already in gray list? */
+          || (isold(o) && (getage(o) != G_TOUCHED1 || cards)));
+  if (cards)  /* the write can be anywhere in the table */
+    dirtycards(g, gco2t(o));
+  if (o->tt == ILYA_VTABLE && gco2t(o) == g->travtable)
+    g->travtable = NULL;  /* atomic phase will traverse it again */
+  if (getage(o) == G_TOUCHED2 || getage(o) == G_TOUCHED1)  /* in a list? */
     set2gray(o);  /* make it gray to become touched1 */
   else  /* link it in 'grayagain' and paint it gray */
     linkobjgclist(o, g->grayagain);
@@ -303,6 +584,8 @@ GCObject *ilyaC_newobjdt (ilya_State *L, lu_byte tt, size_t sz, size_t offset) {
   o->tt = tt;
   o->next = g->allgc;
   g->allgc = o;
+  if (l_unlikely(g->memacct != NULL))
+    ilyaM_acctnew(L, o, sz);
   return o;
 }
 
@@ -428,6 +711,7 @@ static void remarkupvals (global_State *g) {
 
 
 static void cleargraylists (global_State *g) {
+  g->travtable = NULL;
   g->gray = g->grayagain = NULL;
   g->weak = g->allweak = g->ephemeron = NULL;
 }
@@ -483,11 +767,14 @@ static void genlink (global_State *g, GCObject *o) {
 ** put it in 'weak' list, to be cleared.
 */
 static void traverseweakvalue (global_State *g, Table *h) {
-  Node *n, *limit = gnodelast(h);
+  unsigned osize;
+  Node *old = ilyaH_oldnodes(h, &osize);
+  unsigned i, nsize = osize + sizenode(h);
   /* if there is array part, assume it may have white values (it is not
      worth traversing it now just to check) */
   int hasclears = (h->asize > 0);
-  for (n = gnode(h, 0); n < limit; n++) {  /* traverse hash part */
+  for (i = 0; i < nsize; i++) {  /* traverse hash part */
+    Node *n = hashnode(h, old, osize, i);
     if (isempty(gval(n)))  /* entry is empty? */
       clearkey(n);  /* clear its key */
     else {
@@ -538,12 +825,14 @@ static int traverseephemeron (global_State *g, Table *h, int inv) {
   int hasclears = 0;  /* true if table has white keys */
   int hasww = 0;  /* true if table has entry "white-key -> white-value" */
   unsigned int i;
-  unsigned int nsize = sizenode(h);
+  unsigned osize;
+  Node *old = ilyaH_oldnodes(h, &osize);
+  unsigned int nsize = osize + sizenode(h);
   int marked = traversearray(g, h);  /* traverse array part */
   /* traverse hash part; if 'inv', traverse descending
      (see 'convergeephemerons') */
   for (i = 0; i < nsize; i++) {
-    Node *n = inv ? gnode(h, nsize - 1 - i) : gnode(h, i);
+    Node *n = hashnode(h, old, osize, inv ? nsize - 1 - i : i);
     if (isempty(gval(n)))  /* entry is empty? */
       clearkey(n);  /* clear its key */
     else if (iscleared(g, gckeyN(n))) {  /* key is not marked (yet)? */
@@ -569,10 +858,35 @@ static int traverseephemeron (global_State *g, Table *h, int inv) {
 }
 
 
-static void traversestrongtable (global_State *g, Table *h) {
-  Node *n, *limit = gnodelast(h);
-  traversearray(g, h);
-  for (n = gnode(h, 0); n < limit; n++) {  /* traverse hash part */
+/*
+** Number of slots of a table in the hash part, including the nodes of
+** an old hash part still being moved.
+*/
+static unsigned nodeslots (Table *h) {
+  unsigned osize;
+  ilyaH_oldnodes(h, &osize);
+  return osize + allocsizenode(h);
+}
+
+
+/*
+** Traverse the slots [i, lim) of a strong table, numbering first the
+** array part and then the nodes of the hash part (old nodes first).
+** Nodes being moved only go from the old part to the new one, that is,
+** forward, so a partial traversal does not miss them.
+*/
+static void traverseslots (global_State *g, Table *h, unsigned i,
+                                                      unsigned lim) {
+  unsigned asize = h->asize;
+  unsigned osize;
+  Node *old = ilyaH_oldnodes(h, &osize);
+  for (; i < lim && i < asize; i++) {  /* traverse array part */
+    GCObject *o = gcvalarr(h, i);
+    if (o != NULL && iswhite(o))
+      reallymarkobject(g, o);
+  }
+  for (; i < lim; i++) {  /* traverse hash part */
+    Node *n = hashnode(h, old, osize, i - asize);
     if (isempty(gval(n)))  /* entry is empty? */
       clearkey(n);  /* clear its key */
     else {
@@ -581,7 +895,91 @@ static void traversestrongtable (global_State *g, Table *h) {
       markvalue(g, gval(n));
     }
   }
+}
+
+
+/*
+** Traverse only the dirty cards of a touched table in a minor
+** collection, advancing their bits. Returns 0 if the table must be
+** traversed entirely.
+*/
+static int traversecards (global_State *g, Table *h) {
+  CardSet *cs;
+  unsigned int c;
+  if (g->gckind != KGC_GENMINOR ||
+      (getage(h) != G_TOUCHED1 && getage(h) != G_TOUCHED2))
+    return 0;
+  cs = *findcards(g, h);
+  ilya_assert(cs->asize == h->asize);
+  for (c = 0; c < hashcard(cs); c++) {
+    if (cs->cards[c] != 0) {
+      unsigned int i = c << CARDBITS;
+      unsigned int lim = i + (1u << CARDBITS);
+      traverseslots(g, h, i, (lim < h->asize) ? lim : h->asize);
+      cs->cards[c] = (cs->cards[c] & CARDCUR) ? CARDPREV : 0;
+    }
+  }
+  if (cs->cards[c] != 0) {
+    traverseslots(g, h, h->asize, h->asize + nodeslots(h));
+    cs->cards[c] = (cs->cards[c] & CARDCUR) ? CARDPREV : 0;
+  }
+  return 1;
+}
+
+
+/*
+** In the propagate phase of an incremental cycle, a large table is
+** traversed in slices of GCTRAVMAX slots. Between slices, the table is
+** black but out of any gray list, and 'g->travtable' tells where to
+** resume. A back barrier on it cancels the resumption, because it goes
+** to 'grayagain' to be traversed again in the atomic phase (see
+** 'ilyaC_barrierback_'). Without barriers, entries only change position
+** when the table is resized, when an insertion moves a node to a free
+** slot, which always moves 'lastfree', or when an old hash part is
+** done moving. In those cases, the traversal restarts, in one go, to
+** ensure progress.
+*/
+static int samelayout (global_State *g, Table *h) {
+  unsigned osize;
+  return (g->travasize == h->asize && g->travnode == h->node &&
+          g->travfree == ilyaH_lastfree(h) &&
+          g->travold == ilyaH_oldnodes(h, &osize));
+}
+
+
+static l_mem traversestrongtable (global_State *g, Table *h) {
+  unsigned total = h->asize + nodeslots(h);
+  unsigned i = 0;
+  int slice = (g->gcstate == GCSpropagate && g->gckind != KGC_GENMINOR);
+  if (h == g->travtable) {  /* resuming a partial traversal? */
+    g->travtable = NULL;
+    if (samelayout(g, h))
+      i = g->travpos;
+    else  /* entries may have moved */
+      slice = 0;  /* traverse it all again */
+  }
+  else if (hascards(h) && traversecards(g, h)) {
+    genlink(g, obj2gco(h));
+    return 1 + total;
+  }
+  if (slice && total - i > GCTRAVMAX) {
+    unsigned lim = i + GCTRAVMAX;
+    unsigned osize;
+    /* cannot detect moves in a hash part without 'lastfree' */
+    if (lim <= h->asize || ilyaH_lastfree(h) != NULL) {
+      traverseslots(g, h, i, lim);
+      g->travtable = h;
+      g->travasize = h->asize;
+      g->travnode = h->node;
+      g->travfree = ilyaH_lastfree(h);
+      g->travold = ilyaH_oldnodes(h, &osize);
+      g->travpos = lim;
+      return GCTRAVMAX;
+    }
+  }
+  traverseslots(g, h, i, total);
   genlink(g, obj2gco(h));
+  return 1 + (total - i);
 }
 
 
@@ -601,10 +999,12 @@ static l_mem traversetable (global_State *g, Table *h) {
       traverseephemeron(g, h, 0);
     else  /* all weak */
       linkgclist(h, g->allweak);  /* nothing to traverse now */
+    if (h == g->travtable)  /* became weak between slices? */
+      g->travtable = NULL;  /* weak traversals are never partial */
   }
   else  /* not weak */
-    traversestrongtable(g, h);
-  return 1 + 2*sizenode(h) + h->asize;
+    return traversestrongtable(g, h);
+  return 1 + 2*nodeslots(h) + h->asize;
 }
 
 
@@ -705,7 +1105,10 @@ static l_mem traversethread (global_State *g, ilya_State *th) {
 ** of the number of slots traversed.
 */
 static l_mem propagatemark (global_State *g) {
-  GCObject *o = g->gray;
+  GCObject *o;
+  if (g->travtable != NULL)  /* partial table traversal to resume? */
+    return traversetable(g, g->travtable);
+  o = g->gray;
   nw2black(o);
   g->gray = *getgclist(o);  /* remove from 'gray' list */
   switch (o->tt) {
@@ -721,7 +1124,7 @@ static l_mem propagatemark (global_State *g) {
 
 
 static void propagateall (global_State *g) {
-  while (g->gray)
+  while (g->gray || g->travtable)
     propagatemark(g);
 }
 
@@ -769,9 +1172,11 @@ static void convergeephemerons (global_State *g) {
 static void clearbykeys (global_State *g, GCObject *l) {
   for (; l; l = gco2t(l)->gclist) {
     Table *h = gco2t(l);
-    Node *limit = gnodelast(h);
-    Node *n;
-    for (n = gnode(h, 0); n < limit; n++) {
+    unsigned osize;
+    Node *old = ilyaH_oldnodes(h, &osize);
+    unsigned i, nsize = osize + sizenode(h);
+    for (i = 0; i < nsize; i++) {
+      Node *n = hashnode(h, old, osize, i);
       if (iscleared(g, gckeyN(n)))  /* unmarked key? */
         setempty(gval(n));  /* remove entry */
       if (isempty(gval(n)))  /* is entry empty? */
@@ -788,7 +1193,8 @@ static void clearbykeys (global_State *g, GCObject *l) {
 static void clearbyvalues (global_State *g, GCObject *l, GCObject *f) {
   for (; l != f; l = gco2t(l)->gclist) {
     Table *h = gco2t(l);
-    Node *n, *limit = gnodelast(h);
+    unsigned osize;
+    Node *old = ilyaH_oldnodes(h, &osize);
     unsigned int i;
     unsigned int asize = h->asize;
     for (i = 0; i < asize; i++) {
@@ -796,7 +1202,8 @@ static void clearbyvalues (global_State *g, GCObject *l, GCObject *f) {
       if (iscleared(g, o))  /* value was collected? */
         *getArrTag(h, i) = ILYA_VEMPTY;  /* remove entry */
     }
-    for (n = gnode(h, 0); n < limit; n++) {
+    for (i = 0; i < osize + sizenode(h); i++) {
+      Node *n = hashnode(h, old, osize, i);
       if (iscleared(g, gcvalueN(gval(n))))  /* unmarked value? */
         setempty(gval(n));  /* remove entry */
       if (isempty(gval(n)))  /* is entry empty? */
@@ -815,6 +1222,8 @@ static void freeupval (ilya_State *L, UpVal *uv) {
 
 static void freeobj (ilya_State *L, GCObject *o) {
   assert_code(l_mem newmem = gettotalbytes(G(L)) - objsize(o));
+  if (l_unlikely(G(L)->memacct != NULL))
+    ilyaM_acctfree(G(L), o);
   switch (o->tt) {
     case ILYA_VPROTO:
       ilyaF_freeproto(L, gco2p(o));
@@ -832,9 +1241,16 @@ static void freeobj (ilya_State *L, GCObject *o) {
       ilyaM_freemem(L, cl, sizeCclosure(cl->nupvalues));
       break;
     }
-    case ILYA_VTABLE:
-      ilyaH_free(L, gco2t(o));
+    case ILYA_VTABLE: {
+      Table *t = gco2t(o);
+      if (hascards(t)) {  /* card set is not part of 'objsize' */
+        CardSet **p = findcards(G(L), t);
+        assert_code(newmem -= cast(l_mem, sizecardset((*p)->ncards)));
+        deletecards(L, p);
+      }
+      ilyaH_free(L, t);
       break;
+    }
     case ILYA_VTHREAD:
       ilyaE_freethread(L, gco2th(o));
       break;
@@ -910,11 +1326,14 @@ static GCObject **sweeptolive (ilya_State *L, GCObject **p) {
 */
 
 /*
-** If possible, shrink string table.
+** If possible, shrink string table. (If it is still being resized,
+** move more of its buckets instead.)
 */
 static void checkSizes (ilya_State *L, global_State *g) {
   if (!g->gcemergency) {
-    if (g->strt.nuse < g->strt.size / 4)  /* string table too big? */
+    if (g->strt.old != NULL)  /* resize in progress? */
+      ilyaS_migrate(L, GCSWEEPMAX);
+    else if (g->strt.nuse < g->strt.size / 4)  /* string table too big? */
       ilyaS_resize(L, g->strt.size / 2);
   }
 }
@@ -1072,6 +1491,276 @@ void ilyaC_checkfinalizer (ilya_State *L, GCObject *o, Table *mt) {
 /* }====================================================== */
 
 
+/*
+** {======================================================
+** Statistics and self-tuning ("auto") mode
+** =======================================================
+*/
+
+/*
+** In auto mode, the collector picks its mode and tunes its generational
+** parameters looking at the last collections (see 'GCStats'):
+** - In minor mode, a high survival rate of new bytes first enlarges
+**   the nursery (minor multiplier); if that is not enough, the
+**   generational mode is not paying off, and the collector switches
+**   to incremental mode. A very low rate with long minor pauses shrinks
+**   the nursery, as it costs little.
+** - A major collection that frees little means the shift to major mode
+**   came too early (minor-major multiplier goes up); one that frees a
+**   lot means it came late. Going back to major mode soon after
+**   returning to minor mode makes that return harder (major-minor
+**   multiplier goes up).
+** - In incremental mode, the collector tries generational mode again
+**   after some cycles, doubling that interval after each failure.
+** The window is cleared after each decision, so that the next one only
+** sees collections done with the new settings.
+*/
+
+/* minimum number of minor collections in the window for a decision */
+#define AUTOMINSAMPLES	4
+
+/* limits (%) for the survival rate of new bytes in minor collections */
+#define AUTOHIGHSURV	50
+#define AUTOLOWSURV	10
+
+/* limits (%) for bytes freed by major collections */
+#define AUTOLOWFREED	20
+#define AUTOHIGHFREED	60
+
+/* minor pauses (bytes marked) long enough to shrink the nursery */
+#define AUTOLONGPAUSE	(l_mem)(256 * 1024)
+
+/* range for the minor multiplier */
+#define AUTOMINMUL	10
+#define AUTOMAXMUL	100
+
+/* range for the minor-major and major-minor multipliers */
+#define AUTOMINMM	20
+#define AUTOMAXMM	300
+
+/* range for the number of incremental cycles between probes */
+#define AUTOMINPROBE	2
+#define AUTOMAXPROBE	64
+
+#define getgcparam(g,p)	cast_int(applygcparam(g, p, 100))
+
+
+/* percentage of 'a' in 'b' */
+static int percent (l_mem a, l_mem b) {
+  if (b <= 0 || a >= b)
+    return 100;
+  return cast_int(cast_num(a) * 100 / cast_num(b));
+}
+
+
+/*
+** Record a collection of the given kind, which found 'live' bytes out
+** of 'alloc' bytes (new bytes for a minor collection; all bytes
+** otherwise).
+*/
+static void recordcollection (global_State *g, int kind, l_mem alloc,
+                                                        l_mem live) {
+  GCStats *st = &g->gcstats;
+  st->alloc[st->wnext] = alloc;
+  st->live[st->wnext] = live;
+  st->kind[st->wnext] = cast_byte(kind);
+  st->wnext = (st->wnext + 1) % GCSWINDOW;
+  if (st->nwindow < GCSWINDOW)
+    st->nwindow++;
+  st->count[kind]++;
+  st->work[kind] += live;
+  st->pending = 1;
+}
+
+
+/* number of steps in the histogram of pauses that makes it decay */
+#define GCSDECAY	1024
+
+
+/*
+** Add the size of a finished step (bytes marked) to the histogram of
+** pauses. Bucket 'i' counts steps that marked less than 2^(i+1) Kbytes.
+** When the histogram holds GCSDECAY steps, all its counts are halved,
+** so that old steps fade away.
+*/
+static void recordstep (global_State *g) {
+  GCStats *st = &g->gcstats;
+  l_mem kb = st->stepwork >> 10;
+  int i = 0;
+  while (kb > 1 && i < ILYA_GCSNPAUSES - 1) {
+    kb >>= 1;
+    i++;
+  }
+  st->pauses[i]++;
+  st->stepwork = 0;
+  if (++st->nsteps >= GCSDECAY) {
+    st->nsteps = 0;
+    for (i = 0; i < ILYA_GCSNPAUSES; i++) {
+      st->pauses[i] >>= 1;
+      st->nsteps += st->pauses[i];
+    }
+  }
+}
+
+
+/*
+** Survival rate (%) of new bytes in the minor collections in the
+** window, or -1 if there are too few of them. Also returns in 'pause'
+** the average number of bytes marked by them.
+*/
+static int minorsurvival (const GCStats *st, l_mem *pause) {
+  l_mem alloc = 0, live = 0;
+  int i, n = 0;
+  for (i = 0; i < st->nwindow; i++) {
+    if (st->kind[i] == KGC_GENMINOR) {
+      alloc += st->alloc[i];
+      live += st->live[i];
+      n++;
+    }
+  }
+  if (n < AUTOMINSAMPLES)
+    return -1;
+  *pause = live / n;
+  return percent(live, alloc);
+}
+
+
+static void decide (GCStats *st, lu_byte decision) {
+  st->decision = decision;
+  st->nwindow = st->wnext = 0;  /* clear the window */
+}
+
+
+/* set parameter to 'v' clipped to [lo, hi]; return whether it changed */
+static int tuneparam (global_State *g, int p, int v, int lo, int hi) {
+  int old = cast_int(ilyaO_applyparam(g->gcparams[p], 100));
+  if (v < lo) v = lo;
+  else if (v > hi) v = hi;
+  g->gcparams[p] = ilyaO_codeparam(cast_uint(v));
+  return cast_int(ilyaO_applyparam(g->gcparams[p], 100)) != old;
+}
+
+
+static void tuneminor (ilya_State *L, global_State *g, GCStats *st) {
+  l_mem pause;
+  int surv = minorsurvival(st, &pause);
+  int mul = getgcparam(g, MINORMUL);
+  st->minors++;
+  if (surv < 0)
+    return;  /* not enough information */
+  else if (surv >= AUTOHIGHSURV) {
+    if (tuneparam(g, ILYA_GCPMINORMUL, mul * 3 / 2, AUTOMINMUL, AUTOMAXMUL))
+      decide(st, ILYA_GCDMINORMUL);
+    else {  /* nursery is already large; use incremental mode */
+      decide(st, ILYA_GCDTOINC);
+      st->switches++;
+      st->waited = 0;
+      st->probe = (st->probe < AUTOMAXPROBE / 2) ? 2 * st->probe
+                                                  : AUTOMAXPROBE;
+      ilyaC_changemode(L, KGC_INC);
+    }
+  }
+  else {
+    st->probe = AUTOMINPROBE;  /* generational mode is working */
+    if (surv < AUTOLOWSURV && pause > AUTOLONGPAUSE &&
+        tuneparam(g, ILYA_GCPMINORMUL, mul * 2 / 3, AUTOMINMUL, AUTOMAXMUL))
+      decide(st, ILYA_GCDMINORMUL);
+  }
+}
+
+
+static void tunemajor (global_State *g, GCStats *st) {
+  int last = (st->wnext + GCSWINDOW - 1) % GCSWINDOW;
+  int freed = 100 - percent(st->live[last], st->alloc[last]);
+  int mm = getgcparam(g, MINORMAJOR);
+  if (st->minors < AUTOMINSAMPLES) {  /* came back too soon? */
+    if (tuneparam(g, ILYA_GCPMAJORMINOR, getgcparam(g, MAJORMINOR) * 3 / 2,
+                                         AUTOMINMM, AUTOMAXMM))
+      decide(st, ILYA_GCDMAJORMINOR);
+  }
+  else if (freed < AUTOLOWFREED) {
+    if (tuneparam(g, ILYA_GCPMINORMAJOR, mm * 3 / 2, AUTOMINMM, AUTOMAXMM))
+      decide(st, ILYA_GCDMINORMAJOR);
+  }
+  else if (freed > AUTOHIGHFREED) {
+    if (tuneparam(g, ILYA_GCPMINORMAJOR, mm * 2 / 3, AUTOMINMM, AUTOMAXMM))
+      decide(st, ILYA_GCDMINORMAJOR);
+  }
+  st->minors = 0;
+}
+
+
+/*
+** Called after a collector step that finished some collection.
+*/
+static void autotune (ilya_State *L, global_State *g) {
+  GCStats *st = &g->gcstats;
+  int last = st->kind[(st->wnext + GCSWINDOW - 1) % GCSWINDOW];
+  st->pending = 0;
+  switch (last) {
+    case KGC_GENMINOR: tuneminor(L, g, st); break;
+    case KGC_GENMAJOR: tunemajor(g, st); break;
+    default: {  /* incremental cycle */
+      ilya_assert(last == KGC_INC);
+      if (g->gckind == KGC_INC && ++st->waited >= st->probe) {
+        decide(st, ILYA_GCDTOGEN);  /* try generational mode again */
+        st->switches++;
+        st->minors = 0;
+        ilyaC_changemode(L, KGC_GENMINOR);
+      }
+      break;
+    }
+  }
+}
+
+
+/*
+** Turn on the auto mode.
+*/
+void ilyaC_setauto (ilya_State *L) {
+  global_State *g = G(L);
+  GCStats *st = &g->gcstats;
+  g->gcauto = 1;
+  st->probe = AUTOMINPROBE;
+  st->waited = st->minors = 0;
+  decide(st, ILYA_GCDNONE);
+}
+
+
+/* counters that do not fit in an int are reported as INT_MAX */
+static int satint (l_mem x) {
+  return (x < INT_MAX) ? cast_int(x) : INT_MAX;
+}
+
+
+int ilyaC_gcstat (ilya_State *L, int what) {
+  const GCStats *st = &G(L)->gcstats;
+  switch (what) {
+    case ILYA_GCSMINOR: return satint(st->count[KGC_GENMINOR]);
+    case ILYA_GCSMAJOR: return satint(st->count[KGC_GENMAJOR]);
+    case ILYA_GCSINC: return satint(st->count[KGC_INC]);
+    case ILYA_GCSMINORWORK: return satint(st->work[KGC_GENMINOR] >> 10);
+    case ILYA_GCSMAJORWORK: return satint(st->work[KGC_GENMAJOR] >> 10);
+    case ILYA_GCSINCWORK: return satint(st->work[KGC_INC] >> 10);
+    case ILYA_GCSSURVIVAL: {
+      l_mem pause;
+      return minorsurvival(st, &pause);
+    }
+    case ILYA_GCSSWITCHES: return st->switches;
+    case ILYA_GCSDECISION: return st->decision;
+    default: {
+      int i = what - ILYA_GCSPAUSES;
+      if (0 <= i && i < ILYA_GCSNPAUSES)
+        return satint(st->pauses[i]);
+      return -1;  /* invalid option */
+    }
+  }
+}
+
+/* }====================================================== */
+
+
+
 /*
 ** {======================================================
 ** Generational Collector
@@ -1097,11 +1786,14 @@ void ilyaC_checkfinalizer (ilya_State *L, GCObject *o, Table *mt) {
 /*
 ** Set the "time" to wait before starting a new incremental cycle;
 ** cycle will start when number of bytes in use hits the threshold of
-** approximately (marked * pause / 100).
+** approximately (marked * pause / 100). Bytes held outside the heap
+** ('GCexternal') are in the number of bytes in use, and they are live
+** until their owner gives them back, so they count as marked.
 */
 static void setpause (global_State *g) {
-  l_mem threshold = applygcparam(g, PAUSE, g->GCmarked);
+  l_mem threshold = applygcparam(g, PAUSE, g->GCmarked + g->GCexternal);
   l_mem debt = threshold - gettotalbytes(g);
+  g->gcstats.lasttotal = gettotalbytes(g);
   if (debt < 0) debt = 0;
   ilyaE_setdebt(g, debt);
 }
@@ -1288,6 +1980,7 @@ static void minor2inc (ilya_State *L, global_State *g, lu_byte kind) {
   g->gckind = kind;
   g->reallyold = g->old1 = g->survival = NULL;
   g->finobjrold = g->finobjold1 = g->finobjsur = NULL;
+  freeallcards(L, g);  /* cards are only used in minor collections */
   entersweep(L);  /* continue as an incremental cycle */
   /* set a debt equal to the step size */
   ilyaE_setdebt(g, applygcparam(g, STEPSIZE, 100));
@@ -1315,6 +2008,7 @@ static int checkminormajor (global_State *g) {
 static void youngcollection (ilya_State *L, global_State *g) {
   l_mem addedold1 = 0;
   l_mem marked = g->GCmarked;  /* preserve 'g->GCmarked' */
+  l_mem added = gettotalbytes(g) - g->gcstats.lasttotal;  /* new bytes */
   GCObject **psurvival;  /* to point to first non-dead survival object */
   GCObject *dummy;  /* dummy out parameter to 'sweepgen' */
   ilya_assert(g->gcstate == GCSpropagate);
@@ -1326,6 +2020,8 @@ static void youngcollection (ilya_State *L, global_State *g) {
   markold(g, g->tobefnz, NULL);
 
   atomic(L);  /* will lose 'g->marked' */
+  recordcollection(g, KGC_GENMINOR, added, g->GCmarked - marked);
+  g->gcstats.stepwork += g->GCmarked - marked;
 
   /* sweep nursery and get a pointer to its last live element */
   g->gcstate = GCSswpallgc;
@@ -1395,6 +2091,7 @@ static void atomic2gen (ilya_State *L, global_State *g) {
 ** after the last major collection.
 */
 static void setminordebt (global_State *g) {
+  g->gcstats.lasttotal = gettotalbytes(g);
   ilyaE_setdebt(g, applygcparam(g, MINORMUL, g->GCmajorminor));
 }
 
@@ -1502,6 +2199,21 @@ static void deletelist (ilya_State *L, GCObject *p, GCObject *limit) {
 }
 
 
+/*
+** Objects of an arena state are released with the arena, but external
+** strings in list 'p' must still give their buffers back.
+*/
+static void freeexternal (GCObject *p) {
+  for (; p != NULL; p = p->next) {
+    if (p->tt == ILYA_VLNGSTR) {
+      TString *ts = gco2ts(p);
+      if (ts->shrlen == LSTRMEM)
+        (*ts->falloc)(ts->ud, ts->contents, ts->u.lnglen + 1, 0);
+    }
+  }
+}
+
+
 /*
 ** Call all finalizers of the objects in the given Ilya state, and
 ** then free all objects, except for the main thread.
@@ -1513,6 +2225,11 @@ void ilyaC_freeallobjects (ilya_State *L) {
   separatetobefnz(g, 1);  /* separate all objects with finalizers */
   ilya_assert(g->finobj == NULL);
   callallpendingfinalizers(L);
+  if (g->arena) {  /* objects are released with the arena */
+    freeexternal(g->allgc);
+    freeexternal(g->fixedgc);
+    return;
+  }
   deletelist(L, g->allgc, obj2gco(g->mainthread));
   ilya_assert(g->finobj == NULL);  /* no new finalizers */
   deletelist(L, g->fixedgc, NULL);  /* collect fixed objects */
@@ -1607,7 +2324,7 @@ static l_mem singlestep (ilya_State *L, int fast) {
       break;
     }
     case GCSpropagate: {
-      if (fast || g->gray == NULL) {
+      if (fast || (g->gray == NULL && g->travtable == NULL)) {
         g->gcstate = GCSenteratomic;  /* finish propagate phase */
         stepresult = 1;
       }
@@ -1617,6 +2334,7 @@ static l_mem singlestep (ilya_State *L, int fast) {
     }
     case GCSenteratomic: {
       atomic(L);
+      recordcollection(g, g->gckind, gettotalbytes(g), g->GCmarked);
       if (checkmajorminor(L, g))
         stepresult = step2minor;
       else {
@@ -1627,6 +2345,10 @@ static l_mem singlestep (ilya_State *L, int fast) {
     }
     case GCSswpallgc: {  /* sweep "regular" objects */
       sweepstep(L, g, GCSswpfinobj, &g->finobj, fast);
+      /* help pending string-table resize, except in emergencies, which
+         can happen while 'internshrstr' holds a bucket */
+      if (!g->gcemergency)
+        ilyaS_migrate(L, GCSWEEPMAX);
       stepresult = GCSWEEPMAX;
       break;
     }
@@ -1692,7 +2414,10 @@ static void incstep (ilya_State *L, global_State *g) {
   l_mem stres;
   int fast = (work2do == 0);  /* special case: do a full collection */
   do {  /* repeat until enough work */
+    l_mem marked = g->GCmarked;
     stres = singlestep(L, fast);  /* perform one single step */
+    if (g->GCmarked > marked)
+      g->gcstats.stepwork += g->GCmarked - marked;
     if (stres == step2minor)  /* returned to minor collections? */
       return;  /* nothing else to be done here */
     else if (stres == step2pause || (stres == atomicstep && !fast))
@@ -1734,6 +2459,9 @@ void ilyaC_step (ilya_State *L) {
         setminordebt(g);
         break;
     }
+    recordstep(g);
+    if (g->gcauto && g->gcstats.pending)
+      autotune(L, g);
     ilyai_tracegc(L, 0);  /* for internal debugging */
   }
 }
@@ -1781,3 +2509,430 @@ void ilyaC_fullgc (ilya_State *L, int isemergency) {
 /* }====================================================== */
 
 
+
+
+/*
+** {======================================================
+** Memory use by type and by thread
+** =======================================================
+*/
+
+/*
+** Both functions walk all objects, so the results include garbage not
+** yet collected.
+*/
+static void typelist (GCObject *o, l_mem *bytes) {
+  for (; o != NULL; o = o->next)
+    bytes[novariant(o->tt)] += objsize(o);
+}
+
+
+/*
+** Fills 'bytes' with the bytes used by the objects of each type,
+** indexed by basic type, plus ILYA_TUPVAL and ILYA_TPROTO.
+*/
+void ilyaC_typememory (ilya_State *L, l_mem *bytes) {
+  global_State *g = G(L);
+  int i;
+  for (i = 0; i <= ILYA_TPROTO; i++)
+    bytes[i] = 0;
+  typelist(g->allgc, bytes);
+  typelist(g->finobj, bytes);
+  typelist(g->tobefnz, bytes);
+  typelist(g->fixedgc, bytes);
+}
+
+
+/*
+** Charges the current size of object 'o' to the thread that created it
+** (see 'ilyaM_acctnew'). Threads keep the size they had when created,
+** as their stacks count for themselves.
+*/
+void ilyaC_acctresize (ilya_State *L, GCObject *o) {
+  ilya_assert(o->tt != ILYA_VTHREAD);
+  ilyaM_acctsize(G(L), o, objsize(o));
+}
+
+
+/*
+** Memory used by thread 'co': its own size plus, when accounting is
+** on, the sizes of the objects it created that are still alive.
+*/
+l_mem ilyaC_threadmemory (ilya_State *L, ilya_State *co) {
+  global_State *g = G(L);
+  l_mem res = cast(l_mem, ilyaE_threadsize(co));
+  if (g->memacct != NULL)
+    res += ilyaM_acctbytes(g, co->memid);
+  return res;
+}
+
+/* }====================================================== */
+
+
+
+
+/*
+** {======================================================
+** Heap snapshot
+** =======================================================
+*/
+
+/*
+** A snapshot is a sequence of lines, each one a JSON object describing
+** one collectable object: its address ("id"), its type, its size, and
+** its outgoing references ("edges"), each one a pair with the address
+** of the referred object and a name for the reference. The first line
+** is a pseudo-object with id "roots", whose edges are the roots of the
+** collector. Weak tables have a field "weak" with their mode, so that
+** tools may ignore references that do not keep objects alive.
+*/
+
+#define SNAPBUFFSIZE	1024
+
+/* maximum number of bytes from a string used as a name */
+#define SNAPMAXNAME	48
+
+
+typedef struct Snapshot {
+  ilya_State *L;
+  ilya_Writer writer;
+  void *data;
+  int status;  /* result from last call to the writer */
+  int nedges;  /* number of edges already written for current object */
+  size_t n;  /* number of bytes in the buffer */
+  char buff[SNAPBUFFSIZE];
+} Snapshot;
+
+
+static void snapflush (Snapshot *S) {
+  if (S->n > 0 && S->status == 0) {
+    ilya_unlock(S->L);
+    S->status = (*S->writer)(S->L, S->buff, S->n, S->data);
+    ilya_lock(S->L);
+  }
+  S->n = 0;
+}
+
+
+static void snapwrite (Snapshot *S, const char *s, size_t l) {
+  ilya_assert(l <= SNAPBUFFSIZE);
+  if (S->n + l > SNAPBUFFSIZE)
+    snapflush(S);
+  memcpy(S->buff + S->n, s, l);
+  S->n += l;
+}
+
+
+#define snaplit(S,s)	snapwrite(S, "" s, sizeof(s) - 1)
+
+
+/*
+** Writes a string as a JSON string, truncated to SNAPMAXNAME bytes.
+** Bytes outside printable ASCII are written as escapes, so that the
+** result is always valid UTF-8.
+*/
+static void snapname (Snapshot *S, const char *s, size_t l) {
+  char buff[SNAPMAXNAME * 6 + 8];
+  size_t n = 0;
+  size_t i;
+  buff[n++] = '"';
+  for (i = 0; i < l && i < SNAPMAXNAME; i++) {
+    unsigned char c = cast(unsigned char, s[i]);
+    if (c == '"' || c == '\\') {
+      buff[n++] = '\\';
+      buff[n++] = cast_char(c);
+    }
+    else if (c < 0x20 || c >= 0x7F)
+      n += cast_sizet(l_sprintf(buff + n, 7, "\\u%04x", c));
+    else
+      buff[n++] = cast_char(c);
+  }
+  if (l > SNAPMAXNAME) {  /* truncated? */
+    memcpy(buff + n, "...", 3);
+    n += 3;
+  }
+  buff[n++] = '"';
+  snapwrite(S, buff, n);
+}
+
+
+static void snapid (Snapshot *S, const void *p) {
+  char buff[ILYA_N2SBUFFSZ];
+  int l = ilya_pointer2str(buff, sizeof(buff), p);
+  snaplit(S, "\"");
+  snapwrite(S, buff, cast_sizet(l));
+  snaplit(S, "\"");
+}
+
+
+static void snapnumber (Snapshot *S, l_mem x) {
+  char buff[ILYA_N2SBUFFSZ];
+  int l = ilya_integer2str(buff, sizeof(buff), x);
+  snapwrite(S, buff, cast_sizet(l));
+}
+
+
+static void snapedge (Snapshot *S, GCObject *o, const char *name,
+                      size_t l) {
+  if (o != NULL) {
+    if (S->nedges++ > 0)
+      snaplit(S, ",");
+    snaplit(S, "[");
+    snapid(S, o);
+    snaplit(S, ",");
+    snapname(S, name, l);
+    snaplit(S, "]");
+  }
+}
+
+
+#define snapedgelit(S,o,s)	snapedge(S, o, "" s, sizeof(s) - 1)
+
+#define snapedgeval(S,v,s)	snapedgelit(S, gcvalueN(v), s)
+
+#define snapedgeN(S,o,s)	{ if (o) snapedgelit(S, obj2gco(o), s); }
+
+
+/*
+** Writes the edge for a table entry with key 'key' and value 'v'.
+** String keys are used as names; other keys are written between
+** brackets.
+*/
+static void snapentry (Snapshot *S, const TValue *key, const TValue *v) {
+  char buff[ILYA_N2SBUFFSZ + 2];
+  if (!iscollectable(v))
+    return;
+  else if (ttisstring(key)) {
+    TString *ts = tsvalue(key);
+    snapedge(S, gcvalue(v), getstr(ts), tsslen(ts));
+  }
+  else {
+    size_t l;
+    buff[0] = '[';
+    if (ttisnumber(key))
+      l = 1 + ilyaO_tostringbuff(key, buff + 1);
+    else {
+      const char *tn = ilyaT_typename(ttype(key));
+      l = 1 + strlen(tn);
+      memcpy(buff + 1, tn, l - 1);
+    }
+    buff[l++] = ']';
+    snapedge(S, gcvalue(v), buff, l);
+  }
+}
+
+
+static void snaptable (Snapshot *S, Table *h) {
+  unsigned int asize = h->asize;
+  unsigned int i;
+  unsigned osize;
+  Node *old = ilyaH_oldnodes(h, &osize);
+  snapedgeN(S, h->metatable, "(metatable)");
+  for (i = 0; i < asize; i++) {
+    TValue k, v;
+    setivalue(&k, cast(ilya_Integer, i) + 1);
+    arr2obj(h, i, &v);
+    snapentry(S, &k, &v);
+  }
+  for (i = 0; i < osize + sizenode(h); i++) {
+    Node *n = hashnode(h, old, osize, i);
+    if (!isempty(gval(n))) {
+      TValue k;
+      getnodekey(S->L, &k, n);
+      snapedgelit(S, gckeyN(n), "(key)");
+      snapentry(S, &k, gval(n));
+    }
+  }
+}
+
+
+static void snapfuncname (Snapshot *S, const Proto *p) {
+  char buff[ILYA_IDSIZE + ILYA_N2SBUFFSZ];
+  size_t l;
+  if (p->source)
+    ilyaO_chunkid(buff, getstr(p->source), tsslen(p->source));
+  else
+    strcpy(buff, "?");
+  l = strlen(buff);
+  buff[l++] = ':';
+  l += cast_sizet(ilya_integer2str(buff + l, ILYA_N2SBUFFSZ, p->linedefined));
+  snaplit(S, ",\"name\":");
+  snapname(S, buff, l);
+}
+
+
+static void snapobject (Snapshot *S, GCObject *o) {
+  global_State *g = G(S->L);
+  const char *tname = ilyaT_typename(novariant(o->tt));
+  int i;
+  snaplit(S, "{\"id\":");
+  snapid(S, o);
+  snaplit(S, ",\"type\":\"");
+  snapwrite(S, tname, strlen(tname));
+  snaplit(S, "\",\"size\":");
+  snapnumber(S, objsize(o));
+  switch (o->tt) {  /* extra fields */
+    case ILYA_VSHRSTR: case ILYA_VLNGSTR: {
+      TString *ts = gco2ts(o);
+      snaplit(S, ",\"name\":");
+      snapname(S, getstr(ts), tsslen(ts));
+      break;
+    }
+    case ILYA_VTABLE: {
+      const TValue *mode = gfasttm(g, gco2t(o)->metatable, TM_MODE);
+      if (mode && ttisshrstring(mode)) {
+        const char *smode = getshrstr(tsvalue(mode));
+        int wk = (strchr(smode, 'k') != NULL);
+        int wv = (strchr(smode, 'v') != NULL);
+        if (wk || wv) {
+          snaplit(S, ",\"weak\":\"");
+          if (wk) snaplit(S, "k");
+          if (wv) snaplit(S, "v");
+          snaplit(S, "\"");
+        }
+      }
+      break;
+    }
+    case ILYA_VLCL: {
+      if (gco2lcl(o)->p != NULL)
+        snapfuncname(S, gco2lcl(o)->p);
+      break;
+    }
+    case ILYA_VPROTO: {
+      snapfuncname(S, gco2p(o));
+      break;
+    }
+    default: break;
+  }
+  snaplit(S, ",\"edges\":[");
+  S->nedges = 0;
+  switch (o->tt) {
+    case ILYA_VTABLE: {
+      snaptable(S, gco2t(o));
+      break;
+    }
+    case ILYA_VUSERDATA: {
+      Udata *u = gco2u(o);
+      snapedgeN(S, u->metatable, "(metatable)");
+      for (i = 0; i < u->nuvalue; i++)
+        snapedgeval(S, &u->uv[i].uv, "(uservalue)");
+      break;
+    }
+    case ILYA_VLCL: {
+      LClosure *cl = gco2lcl(o);
+      snapedgeN(S, cl->p, "(proto)");
+      for (i = 0; i < cl->nupvalues; i++) {
+        TString *name = (cl->p && i < cl->p->sizeupvalues)
+                      ? cl->p->upvalues[i].name : NULL;
+        if (cl->upvals[i] == NULL)
+          continue;
+        else if (name != NULL)
+          snapedge(S, obj2gco(cl->upvals[i]), getstr(name), tsslen(name));
+        else
+          snapedgelit(S, obj2gco(cl->upvals[i]), "(upvalue)");
+      }
+      break;
+    }
+    case ILYA_VCCL: {
+      CClosure *cl = gco2ccl(o);
+      for (i = 0; i < cl->nupvalues; i++)
+        snapedgeval(S, &cl->upvalue[i], "(upvalue)");
+      break;
+    }
+    case ILYA_VPROTO: {
+      Proto *f = gco2p(o);
+      snapedgeN(S, f->source, "(source)");
+      for (i = 0; i < f->sizek; i++)
+        snapedgeval(S, &f->k[i], "(constant)");
+      for (i = 0; i < f->sizep; i++)
+        snapedgeN(S, f->p[i], "(proto)");
+      for (i = 0; i < f->sizeupvalues; i++)
+        snapedgeN(S, f->upvalues[i].name, "(debug)");
+      for (i = 0; i < f->sizelocvars; i++)
+        snapedgeN(S, f->locvars[i].varname, "(debug)");
+      break;
+    }
+    case ILYA_VTHREAD: {
+      ilya_State *th = gco2th(o);
+      UpVal *uv;
+      StkId s;
+      if (th->stack.p != NULL) {
+        for (s = th->stack.p; s < th->top.p; s++)
+          snapedgeval(S, s2v(s), "(stack)");
+      }
+      for (uv = th->openupval; uv != NULL; uv = uv->u.open.next)
+        snapedgeN(S, uv, "(upvalue)");
+      break;
+    }
+    case ILYA_VUPVAL: {
+      snapedgeval(S, gco2upv(o)->v.p, "(value)");
+      break;
+    }
+    default: break;  /* strings have no references */
+  }
+  snaplit(S, "]}\n");
+}
+
+
+static void snaplist (Snapshot *S, GCObject *o) {
+  for (; o != NULL && S->status == 0; o = o->next)
+    snapobject(S, o);
+}
+
+
+static void dosnapshot (ilya_State *L, void *ud) {
+  Snapshot *S = cast(Snapshot *, ud);
+  global_State *g = G(L);
+  GCObject *o;
+  int i;
+  snaplit(S, "{\"id\":\"roots\",\"type\":\"roots\",\"size\":0,\"edges\":[");
+  S->nedges = 0;
+  snapedgeval(S, &g->l_registry, "registry");
+  snapedgeN(S, g->mainthread, "mainthread");
+  for (i = 0; i < ILYA_NUMTYPES; i++)
+    snapedgeN(S, g->mt[i], "(metatable)");
+  for (o = g->fixedgc; o != NULL; o = o->next)
+    snapedgelit(S, o, "(fixed)");
+  for (o = g->tobefnz; o != NULL; o = o->next)
+    snapedgelit(S, o, "(finalizing)");
+  snaplit(S, "]}\n");
+  snaplist(S, g->allgc);
+  snaplist(S, g->finobj);
+  snaplist(S, g->tobefnz);
+  snaplist(S, g->fixedgc);
+  snapflush(S);
+}
+
+
+/*
+** Writes a snapshot of all live objects through 'writer', after a
+** full collection. While the heap is being written, the collector is
+** kept from running (also in emergencies), so that no object moves or
+** dies; the writer can allocate memory, but objects created by it may
+** or may not appear in the snapshot. Returns the status from the
+** writer.
+*/
+int ilyaC_heapsnapshot (ilya_State *L, ilya_Writer writer, void *data) {
+  global_State *g = G(L);
+  lu_byte oldstp = g->gcstp;
+  lu_byte oldstopem = g->gcstopem;
+  Snapshot S;
+  int status;
+  ilyaC_fullgc(L, 0);  /* do not report garbage */
+  S.L = L;
+  S.writer = writer;
+  S.data = data;
+  S.status = 0;
+  S.n = 0;
+  g->gcstp |= GCSTPGC;
+  g->gcstopem = 1;
+  status = ilyaD_rawrunprotected(L, dosnapshot, &S);
+  g->gcstp = oldstp;
+  g->gcstopem = oldstopem;
+  if (l_unlikely(status != ILYA_OK))
+    ilyaD_throw(L, status);  /* propagate error from the writer */
+  return S.status;
+}
+
+/* }====================================================== */
+
@@ -251,6 +251,15 @@
 #define ilyaC_barrierback(L,p,v) (  \
 	iscollectable(v) ? ilyaC_objbarrierback(L, p, gcvalue(v)) : cast_void(0))
 
+/* back barrier for the write of value 'v' with key 'k' in table 't' */
+#define ilyaC_barriertable(L,t,k,v) (  \
+	(iscollectable(v) && isblack(t) && iswhite(gcvalue(v))) ?  \
+	ilyaC_barriertable_(L,t,k) : cast_void(0))
+
+/* object 'o' changed its size; tell the per-thread accounting */
+#define ilyaC_acctsize(L,o)  \
+	{ if (l_unlikely(G(L)->memacct != NULL)) ilyaC_acctresize(L,obj2gco(o)); }
+
 ILYAI_FUNC void ilyaC_fix (ilya_State *L, GCObject *o);
 ILYAI_FUNC void ilyaC_freeallobjects (ilya_State *L);
 ILYAI_FUNC void ilyaC_step (ilya_State *L);
@@ -261,8 +270,18 @@ ILYAI_FUNC GCObject *ilyaC_newobjdt (ilya_State *L, lu_byte tt, size_t sz,
                                                  size_t offset);
 ILYAI_FUNC void ilyaC_barrier_ (ilya_State *L, GCObject *o, GCObject *v);
 ILYAI_FUNC void ilyaC_barrierback_ (ilya_State *L, GCObject *o);
+ILYAI_FUNC void ilyaC_barriertable_ (ilya_State *L, Table *t,
+                                                const TValue *key);
+ILYAI_FUNC void ilyaC_dropcards (ilya_State *L, Table *t);
 ILYAI_FUNC void ilyaC_checkfinalizer (ilya_State *L, GCObject *o, Table *mt);
 ILYAI_FUNC void ilyaC_changemode (ilya_State *L, int newmode);
+ILYAI_FUNC void ilyaC_setauto (ilya_State *L);
+ILYAI_FUNC int ilyaC_gcstat (ilya_State *L, int what);
+ILYAI_FUNC void ilyaC_typememory (ilya_State *L, l_mem *bytes);
+ILYAI_FUNC void ilyaC_acctresize (ilya_State *L, GCObject *o);
+ILYAI_FUNC l_mem ilyaC_threadmemory (ilya_State *L, ilya_State *co);
+ILYAI_FUNC int ilyaC_heapsnapshot (ilya_State *L, ilya_Writer writer,
+                                                void *data);
 
 
 #endif
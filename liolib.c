@@ -91,6 +91,17 @@ static int l_checkmode (const char *mode) {
 /* }====================================================== */
 
 
+/*
+** Size of the stdio buffer of a file, which each open file reports to
+** the collector (see 'ilya_gcadjust'); buffers live outside Ilya's
+** heap, but programs that leave many files to be closed by the
+** collector should have them collected sooner.
+*/
+#if !defined(l_filebufsize)
+#define l_filebufsize		BUFSIZ
+#endif
+
+
 #if !defined(l_getc)		/* { */
 
 #if defined(ILYA_USE_POSIX)
@@ -239,11 +250,22 @@ static int f_gc (ilya_State *L) {
 }
 
 
+/*
+** Report the buffer of a just opened file (if the open succeeded);
+** the matching release is done by the file's close fn.
+*/
+static void addbuffer (ilya_State *L, LStream *p) {
+  if (p->f != NULL)
+    ilya_gcadjust(L, l_filebufsize);
+}
+
+
 /*
 ** fn to close regular files
 */
 static int io_fclose (ilya_State *L) {
   LStream *p = tolstream(L);
+  ilya_gcadjust(L, -(ptrdiff_t)l_filebufsize);
   errno = 0;
   return ilyaL_fileresult(L, (fclose(p->f) == 0), NULL);
 }
@@ -262,6 +284,7 @@ static void opencheck (ilya_State *L, const char *fname, const char *mode) {
   p->f = fopen(fname, mode);
   if (l_unlikely(p->f == NULL))
     ilyaL_error(L, "cannot open file '%s' (%s)", fname, strerror(errno));
+  addbuffer(L, p);
 }
 
 
@@ -273,6 +296,7 @@ static int io_open (ilya_State *L) {
   ilyaL_argcheck(L, l_checkmode(md), 2, "invalid mode");
   errno = 0;
   p->f = fopen(filename, mode);
+  addbuffer(L, p);
   return (p->f == NULL) ? ilyaL_fileresult(L, 0, filename) : 1;
 }
 
@@ -282,6 +306,7 @@ static int io_open (ilya_State *L) {
 */
 static int io_pclose (ilya_State *L) {
   LStream *p = tolstream(L);
+  ilya_gcadjust(L, -(ptrdiff_t)l_filebufsize);
   errno = 0;
   return ilyaL_execresult(L, l_pclose(L, p->f));
 }
@@ -295,6 +320,7 @@ static int io_popen (ilya_State *L) {
   errno = 0;
   p->f = l_popen(L, filename, mode);
   p->closef = &io_pclose;
+  addbuffer(L, p);
   return (p->f == NULL) ? ilyaL_fileresult(L, 0, filename) : 1;
 }
 
@@ -303,6 +329,7 @@ static int io_tmpfile (ilya_State *L) {
   LStream *p = newfile(L);
   errno = 0;
   p->f = tmpfile();
+  addbuffer(L, p);
   return (p->f == NULL) ? ilyaL_fileresult(L, 0, NULL) : 1;
 }
 
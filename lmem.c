@@ -11,15 +11,19 @@
 
 
 #include <stddef.h>
+#include <stdio.h>
+#include <string.h>
 
 #include "ilya.h"
 
+#include "lapi.h"
 #include "ldebug.h"
 #include "ldo.h"
 #include "lgc.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
+#include "ltm.h"
 
 
 
@@ -58,6 +62,36 @@
 #define cantryagain(g)	(completestate(g) && !g->gcstopem)
 
 
+/*
+** True if growing the memory in use by 'delta' bytes would go over
+** the state's memory limit.
+*/
+#define overlimit(g,delta)  \
+	(l_unlikely((g)->memlimit > 0) && (delta) > 0 &&  \
+	 gettotalbytes(g) > (g)->memlimit - (delta))
+
+
+/*
+** An allocation that would go over the memory limit runs an emergency
+** collection first; if it still does not fit (or if there cannot be a
+** collection now), the allocation fails as if the allocator itself
+** had failed.
+*/
+static int makeroom (ilya_State *L, l_mem delta) {
+  global_State *g = G(L);
+  if (cantryagain(g)) {
+    ilyaC_fullgc(L, 1);
+    return !overlimit(g, delta);
+  }
+  else
+    return 0;
+}
+
+
+#define updatepeak(g)  \
+	{ if (gettotalbytes(g) > (g)->mempeak) (g)->mempeak = gettotalbytes(g); }
+
+
 
 
 #if defined(EMERGENCYGCTESTS)
@@ -144,12 +178,738 @@ l_noret ilyaM_toobig (ilya_State *L) {
 }
 
 
+/*
+** {==================================================================
+** Sampling allocation profiler
+** ===================================================================
+*/
+
+/*
+** The profiler samples, on average, one allocation every 'rate'
+** bytes. For each sample it records the Ilya stack that did the
+** allocation (a "site") and an estimate of how many bytes that sample
+** represents. Sampled blocks are kept in a pointer map, so that a
+** free can subtract their weight from the live bytes of their sites.
+** All memory used by the profiler itself comes directly from the
+** allocation function and is not counted by the collector.
+*/
+
+/* maximum number of stack levels recorded in a sample */
+#define MPMAXLEVELS	48
+
+/* size of a buffer big enough for any folded stack */
+#define MPBUFFSIZE	((MPMAXLEVELS + 1) * (ILYA_IDSIZE + 16))
+
+
+typedef struct MemSite {
+  char *stack;  /* folded stack ("f1;f2;...;[type]") */
+  unsigned int hash;
+  l_mem live;  /* estimated bytes still allocated */
+  l_mem total;  /* estimated bytes allocated since profiling started */
+} MemSite;
+
+
+typedef struct MemSample {
+  void *block;  /* sampled block (NULL if slot is free) */
+  l_mem weight;  /* estimated bytes represented by this sample */
+  int site;  /* index of its site */
+} MemSample;
+
+
+struct MemProfile {
+  l_mem rate;  /* average number of bytes between samples */
+  l_mem countdown;  /* bytes to be allocated until next sample */
+  unsigned int rand;  /* state for the random intervals */
+  int nsites;  /* number of sites in use */
+  int sizesites;  /* size of array 'sites' */
+  int sizesiteidx;  /* size of 'siteidx' (a power of 2) */
+  int nsamples;  /* number of live samples */
+  int sizesamples;  /* size of 'samples' (a power of 2) */
+  MemSite *sites;
+  int *siteidx;  /* hash of sites (index + 1; 0 if slot is free) */
+  MemSample *samples;  /* hash of sampled blocks */
+};
+
+
+static void *profalloc (global_State *g, size_t n) {
+  return callfrealloc(g, NULL, 0, n);
+}
+
+
+static void proffree (global_State *g, void *block, size_t n) {
+  if (block != NULL)
+    callfrealloc(g, block, n, 0);
+}
+
+
+static unsigned int pointerhash (const void *p) {
+  L_P2I h = cast(L_P2I, p) >> 3;
+  return cast_uint(h ^ (h >> 15)) * 2654435761u;
+}
+
+
+static unsigned int stackhash (const char *s, size_t l) {
+  unsigned int h = 2166136261u;  /* FNV-1a */
+  for (; l > 0; l--)
+    h = (h ^ cast_byte(*s++)) * 16777619u;
+  return h;
+}
+
+
+/*
+** Computes a new countdown, uniformly distributed between half and
+** one and a half times the rate, so that samples do not synchronize
+** with periodic allocation patterns.
+*/
+static void newcountdown (MemProfile *mp) {
+  unsigned int x = mp->rand;
+  x ^= x << 13; x ^= x >> 17; x ^= x << 5;  /* xorshift32 */
+  mp->rand = x;
+  mp->countdown = mp->rate / 2 + cast(l_mem, x % cast_uint(mp->rate)) + 1;
+}
+
+
+/*
+** Appends the name of the activation record 'ci' to buffer 'b',
+** returning the new end of the buffer.
+*/
+static char *framename (char *b, CallInfo *ci) {
+  if (isIlya(ci)) {
+    const Proto *p = ci_func(ci)->p;
+    int line = ilyaG_getfuncline(p, pcRel(ci->u.l.savedpc, p));
+    char *e;
+    if (p->source)
+      ilyaO_chunkid(b, getstr(p->source), tsslen(p->source));
+    else
+      strcpy(b, "?");
+    for (e = b; *e != '\0'; e++)  /* ';' separates frames */
+      if (*e == ';') *e = ',';
+    return e + l_sprintf(e, 16, ":%d", line);
+  }
+  else {
+    strcpy(b, "[C]");
+    return b + 3;
+  }
+}
+
+
+/*
+** Builds in 'buff' the folded stack for an allocation of type 'tag'
+** ('tag' == 0 for blocks that are not objects). Returns its length.
+** The stack cannot be inspected while the collector runs or while a
+** stack is being reallocated (both set 'gcstopem'), as then its
+** pointers may be inconsistent.
+*/
+static size_t foldedstack (ilya_State *L, char *buff, int tag) {
+  CallInfo *levels[MPMAXLEVELS];
+  int n = 0;
+  char *b = buff;
+  if (!G(L)->gcstopem) {
+    CallInfo *ci;
+    for (ci = L->ci; ci != &L->base_ci && n < MPMAXLEVELS; ci = ci->previous)
+      levels[n++] = ci;
+  }
+  while (n-- > 0) {
+    b = framename(b, levels[n]);
+    *b++ = ';';
+  }
+  if (tag == 0)
+    strcpy(b, "[memory]");
+  else
+    l_sprintf(b, ILYA_IDSIZE, "[%s]", ilyaT_typename(tag));
+  return cast_sizet(b - buff) + strlen(b);
+}
+
+
+/*
+** Returns the index of the site with the given stack, creating it if
+** needed. Returns -1 if it cannot allocate memory for a new site.
+*/
+static int getsite (global_State *g, MemProfile *mp,
+                    const char *stack, size_t l) {
+  unsigned int h = stackhash(stack, l);
+  unsigned int mask = cast_uint(mp->sizesiteidx - 1);
+  unsigned int i;
+  MemSite *site;
+  if (mp->sizesiteidx > 0) {
+    for (i = h & mask; mp->siteidx[i] != 0; i = (i + 1) & mask) {
+      site = &mp->sites[mp->siteidx[i] - 1];
+      if (site->hash == h && strcmp(site->stack, stack) == 0)
+        return mp->siteidx[i] - 1;
+    }
+  }
+  if (mp->nsites >= mp->sizesites) {  /* must grow array of sites? */
+    int nsize = (mp->sizesites > 0) ? mp->sizesites * 2 : 32;
+    MemSite *ns = cast(MemSite *, callfrealloc(g, mp->sites,
+                                   cast_sizet(mp->sizesites) * sizeof(MemSite),
+                                   cast_sizet(nsize) * sizeof(MemSite)));
+    if (ns == NULL) return -1;
+    mp->sites = ns;
+    mp->sizesites = nsize;
+  }
+  if (2 * (mp->nsites + 1) > mp->sizesiteidx) {  /* must grow the hash? */
+    int nsize = (mp->sizesiteidx > 0) ? mp->sizesiteidx * 2 : 64;
+    int *ni = cast(int *, profalloc(g, cast_sizet(nsize) * sizeof(int)));
+    int j;
+    if (ni == NULL) return -1;
+    memset(ni, 0, cast_sizet(nsize) * sizeof(int));
+    mask = cast_uint(nsize - 1);
+    for (j = 0; j < mp->nsites; j++) {  /* reinsert old sites */
+      for (i = mp->sites[j].hash & mask; ni[i] != 0; i = (i + 1) & mask) {}
+      ni[i] = j + 1;
+    }
+    proffree(g, mp->siteidx, cast_sizet(mp->sizesiteidx) * sizeof(int));
+    mp->siteidx = ni;
+    mp->sizesiteidx = nsize;
+  }
+  site = &mp->sites[mp->nsites];
+  site->stack = cast_charp(profalloc(g, l + 1));
+  if (site->stack == NULL) return -1;
+  memcpy(site->stack, stack, l + 1);
+  site->hash = h;
+  site->live = site->total = 0;
+  for (i = h & mask; mp->siteidx[i] != 0; i = (i + 1) & mask) {}
+  mp->siteidx[i] = ++mp->nsites;
+  return mp->nsites - 1;
+}
+
+
+static MemSample *findsample (MemProfile *mp, void *block) {
+  if (mp->nsamples > 0) {
+    unsigned int mask = cast_uint(mp->sizesamples - 1);
+    unsigned int i;
+    for (i = pointerhash(block) & mask; mp->samples[i].block != NULL;
+         i = (i + 1) & mask) {
+      if (mp->samples[i].block == block)
+        return &mp->samples[i];
+    }
+  }
+  return NULL;
+}
+
+
+static void insertsample (MemProfile *mp, void *block, l_mem weight,
+                          int site) {
+  unsigned int mask = cast_uint(mp->sizesamples - 1);
+  unsigned int i;
+  for (i = pointerhash(block) & mask; mp->samples[i].block != NULL;
+       i = (i + 1) & mask) {}
+  mp->samples[i].block = block;
+  mp->samples[i].weight = weight;
+  mp->samples[i].site = site;
+  mp->nsamples++;
+}
+
+
+/*
+** Removes sample 's' from the map, shifting back following entries
+** of the same cluster so that lookups do not need tombstones.
+*/
+static void removesample (MemProfile *mp, MemSample *s) {
+  unsigned int mask = cast_uint(mp->sizesamples - 1);
+  unsigned int i = cast_uint(s - mp->samples);
+  unsigned int j = i;
+  mp->nsamples--;
+  for (;;) {
+    unsigned int k;
+    j = (j + 1) & mask;
+    if (mp->samples[j].block == NULL)
+      break;
+    k = pointerhash(mp->samples[j].block) & mask;
+    /* can entry 'j' be moved to 'i'? (its home 'k' is not in (i,j]) */
+    if ((i <= j) ? (i >= k || k > j) : (i >= k && k > j)) {
+      mp->samples[i] = mp->samples[j];
+      i = j;
+    }
+  }
+  mp->samples[i].block = NULL;
+}
+
+
+static int growsamples (global_State *g, MemProfile *mp) {
+  int nsize = (mp->sizesamples > 0) ? mp->sizesamples * 2 : 256;
+  MemSample *old = mp->samples;
+  int oldsize = mp->sizesamples;
+  int i;
+  MemSample *ns = cast(MemSample *,
+                       profalloc(g, cast_sizet(nsize) * sizeof(MemSample)));
+  if (ns == NULL) return 0;
+  for (i = 0; i < nsize; i++)
+    ns[i].block = NULL;
+  mp->samples = ns;
+  mp->sizesamples = nsize;
+  mp->nsamples = 0;
+  for (i = 0; i < oldsize; i++) {
+    if (old[i].block != NULL)
+      insertsample(mp, old[i].block, old[i].weight, old[i].site);
+  }
+  proffree(g, old, cast_sizet(oldsize) * sizeof(MemSample));
+  return 1;
+}
+
+
+/*
+** Records a sample for a new 'block' with 'size' bytes. A sample
+** stands for 'rate' bytes, except when the block itself is larger.
+*/
+static void takesample (ilya_State *L, MemProfile *mp, void *block,
+                        size_t size, int tag) {
+  global_State *g = G(L);
+  char buff[MPBUFFSIZE];
+  size_t l = foldedstack(L, buff, tag);
+  int site = getsite(g, mp, buff, l);
+  l_mem weight = (cast(l_mem, size) > mp->rate) ? cast(l_mem, size)
+                                                : mp->rate;
+  newcountdown(mp);
+  if (site < 0)  /* could not create site? */
+    return;  /* ignore sample */
+  mp->sites[site].total += weight;
+  if (2 * (mp->nsamples + 1) > mp->sizesamples && !growsamples(g, mp))
+    return;  /* cannot track it */
+  insertsample(mp, block, weight, site);
+  mp->sites[site].live += weight;
+}
+
+
+/*
+** Block 'block' is being freed; if it was sampled, remove it.
+*/
+static void profforget (MemProfile *mp, void *block) {
+  MemSample *s = findsample(mp, block);
+  if (s != NULL) {
+    mp->sites[s->site].live -= s->weight;
+    removesample(mp, s);
+  }
+}
+
+
+static void profmalloc (ilya_State *L, void *block, size_t size, int tag) {
+  MemProfile *mp = G(L)->memprof;
+  mp->countdown -= cast(l_mem, size);
+  if (mp->countdown <= 0)
+    takesample(L, mp, block, size, tag);
+}
+
+
+/*
+** A reallocated block keeps its sample (and site); otherwise, only
+** its growth counts for the next sample.
+*/
+static void profrealloc (ilya_State *L, void *block, void *newblock,
+                         size_t osize, size_t nsize) {
+  MemProfile *mp = G(L)->memprof;
+  MemSample *s = (block != NULL) ? findsample(mp, block) : NULL;
+  if (s != NULL) {
+    l_mem weight = s->weight;
+    int site = s->site;
+    removesample(mp, s);
+    mp->sites[site].live -= weight;
+    if (newblock != NULL) {  /* not a free? */
+      weight += cast(l_mem, nsize) - cast(l_mem, osize);
+      if (weight < mp->rate) weight = mp->rate;
+      insertsample(mp, newblock, weight, site);  /* map did not grow */
+      mp->sites[site].live += weight;
+      if (nsize > osize)
+        mp->sites[site].total += cast(l_mem, nsize - osize);
+    }
+  }
+  else if (nsize > osize)
+    profmalloc(L, newblock, nsize - osize, 0);
+}
+
+
+/*
+** Starts or retunes (with 'rate' > 0) or stops (with 'rate' == 0) the
+** profiler; a negative rate changes nothing. Stopping discards all
+** collected data. Returns the previous rate (0 if off).
+*/
+int ilyaM_setprofile (ilya_State *L, int rate) {
+  global_State *g = G(L);
+  MemProfile *mp = g->memprof;
+  int oldrate = (mp != NULL) ? cast_int(mp->rate) : 0;
+  if (rate < 0)
+    return oldrate;
+  else if (rate == 0)
+    ilyaM_freeprofile(L);
+  else if (mp != NULL)
+    mp->rate = rate;
+  else {
+    mp = cast(MemProfile *, profalloc(g, sizeof(MemProfile)));
+    if (mp == NULL)
+      ilyaM_error(L);
+    memset(mp, 0, sizeof(MemProfile));
+    mp->rate = rate;
+    mp->rand = g->seed | 1;  /* xorshift state cannot be zero */
+    newcountdown(mp);
+    g->memprof = mp;
+  }
+  return oldrate;
+}
+
+
+void ilyaM_freeprofile (ilya_State *L) {
+  global_State *g = G(L);
+  MemProfile *mp = g->memprof;
+  if (mp != NULL) {
+    int i;
+    g->memprof = NULL;
+    for (i = 0; i < mp->nsites; i++)
+      proffree(g, mp->sites[i].stack, strlen(mp->sites[i].stack) + 1);
+    proffree(g, mp->sites, cast_sizet(mp->sizesites) * sizeof(MemSite));
+    proffree(g, mp->siteidx, cast_sizet(mp->sizesiteidx) * sizeof(int));
+    proffree(g, mp->samples, cast_sizet(mp->sizesamples) * sizeof(MemSample));
+    proffree(g, mp, sizeof(MemProfile));
+  }
+}
+
+
+/*
+** Writes one line "stack bytes" for each site with a non-zero count,
+** in the folded format used by flame-graph tools. 'what' selects
+** live bytes (ILYA_MEMLIVE) or all bytes allocated (ILYA_MEMTOTAL).
+** The writer may allocate memory (and therefore create new sites or
+** even stop the profiler), so each iteration reloads the profiler
+** and copies the line to a private buffer before writing it.
+*/
+int ilyaM_profreport (ilya_State *L, int what, ilya_Writer writer,
+                      void *data) {
+  char buff[MPBUFFSIZE + ILYA_N2SBUFFSZ];
+  int status = 0;
+  int i;
+  for (i = 0; status == 0; i++) {
+    MemProfile *mp = G(L)->memprof;
+    MemSite *site;
+    l_mem n;
+    size_t l;
+    if (mp == NULL || i >= mp->nsites)
+      break;
+    site = &mp->sites[i];
+    n = (what == ILYA_MEMLIVE) ? site->live : site->total;
+    if (n <= 0)
+      continue;
+    l = strlen(site->stack);
+    memcpy(buff, site->stack, l);
+    buff[l++] = ' ';
+    l += cast_sizet(ilya_integer2str(buff + l, ILYA_N2SBUFFSZ, n));
+    buff[l++] = '\n';
+    ilya_unlock(L);
+    status = (*writer)(L, buff, l, data);
+    ilya_lock(L);
+  }
+  return status;
+}
+
+/* }================================================================== */
+
+
+/*
+** {==================================================================
+** Per-thread memory accounting
+** ===================================================================
+*/
+
+/*
+** When accounting is on, each new object is kept in a pointer map
+** with the id of the thread that created it and the number of bytes
+** charged for it, and a second map keeps, for each thread id, the sum
+** of the bytes charged for its live objects. So, the memory used by a
+** coroutine (see 'ilyaC_threadmemory') is a single lookup. An object
+** is charged its size when created and again after each change of size
+** (see 'ilyaC_acctsize'); the stack of a thread is not charged to its
+** creator, as it counts for the thread itself. Objects created while
+** accounting was off belong to no thread. The maps do not run the
+** collector, but their memory counts as memory in use.
+*/
+
+typedef struct MemOwner {
+  GCObject *o;  /* object (NULL if slot is free) */
+  ilya_Unsigned owner;  /* 'memid' of the thread that created it */
+  l_mem size;  /* bytes charged for it */
+} MemOwner;
+
+
+typedef struct MemUse {
+  ilya_Unsigned id;  /* 'memid' of a thread (0 if slot is free) */
+  l_mem bytes;  /* bytes charged for its live objects */
+} MemUse;
+
+
+struct MemAccount {
+  int nuse;  /* number of objects in the map */
+  int size;  /* size of 'slots' (0 or a power of 2) */
+  int nids;  /* number of threads in 'uses' */
+  int sizeuses;  /* size of 'uses' (0 or a power of 2) */
+  MemOwner *slots;
+  MemUse *uses;
+};
+
+
+static void *acctalloc (global_State *g, size_t n) {
+  void *block = callfrealloc(g, NULL, 0, n);
+  if (block != NULL)
+    g->GCdebt -= cast(l_mem, n);
+  return block;
+}
+
+
+static void acctfree (global_State *g, void *block, size_t n) {
+  if (block != NULL) {
+    callfrealloc(g, block, n, 0);
+    g->GCdebt += cast(l_mem, n);
+  }
+}
+
+
+static unsigned int idhash (ilya_Unsigned id) {
+  return cast_uint(id ^ (id >> 31)) * 2654435761u;
+}
+
+
+static MemOwner *findowner (MemAccount *ma, const GCObject *o) {
+  if (ma->nuse > 0) {
+    unsigned int mask = cast_uint(ma->size - 1);
+    unsigned int i;
+    for (i = pointerhash(o) & mask; ma->slots[i].o != NULL;
+         i = (i + 1) & mask) {
+      if (ma->slots[i].o == o)
+        return &ma->slots[i];
+    }
+  }
+  return NULL;
+}
+
+
+static void insertowner (MemAccount *ma, GCObject *o,
+                         ilya_Unsigned owner, l_mem size) {
+  unsigned int mask = cast_uint(ma->size - 1);
+  unsigned int i;
+  for (i = pointerhash(o) & mask; ma->slots[i].o != NULL;
+       i = (i + 1) & mask) {}
+  ma->slots[i].o = o;
+  ma->slots[i].owner = owner;
+  ma->slots[i].size = size;
+  ma->nuse++;
+}
+
+
+static int growowners (global_State *g, MemAccount *ma) {
+  int nsize = (ma->size > 0) ? ma->size * 2 : 1024;
+  MemOwner *old = ma->slots;
+  int oldsize = ma->size;
+  int i;
+  MemOwner *ns = cast(MemOwner *,
+                      acctalloc(g, cast_sizet(nsize) * sizeof(MemOwner)));
+  if (ns == NULL) return 0;
+  for (i = 0; i < nsize; i++)
+    ns[i].o = NULL;
+  ma->slots = ns;
+  ma->size = nsize;
+  ma->nuse = 0;
+  for (i = 0; i < oldsize; i++) {
+    if (old[i].o != NULL)
+      insertowner(ma, old[i].o, old[i].owner, old[i].size);
+  }
+  acctfree(g, old, cast_sizet(oldsize) * sizeof(MemOwner));
+  return 1;
+}
+
+
+static MemUse *finduse (MemAccount *ma, ilya_Unsigned id) {
+  if (ma->nids > 0) {
+    unsigned int mask = cast_uint(ma->sizeuses - 1);
+    unsigned int i;
+    for (i = idhash(id) & mask; ma->uses[i].id != 0; i = (i + 1) & mask) {
+      if (ma->uses[i].id == id)
+        return &ma->uses[i];
+    }
+  }
+  return NULL;
+}
+
+
+static MemUse *insertuse (MemAccount *ma, ilya_Unsigned id, l_mem bytes) {
+  unsigned int mask = cast_uint(ma->sizeuses - 1);
+  unsigned int i;
+  for (i = idhash(id) & mask; ma->uses[i].id != 0; i = (i + 1) & mask) {}
+  ma->uses[i].id = id;
+  ma->uses[i].bytes = bytes;
+  ma->nids++;
+  return &ma->uses[i];
+}
+
+
+static int growuses (global_State *g, MemAccount *ma) {
+  int nsize = (ma->sizeuses > 0) ? ma->sizeuses * 2 : 64;
+  MemUse *old = ma->uses;
+  int oldsize = ma->sizeuses;
+  int i;
+  MemUse *ns = cast(MemUse *,
+                    acctalloc(g, cast_sizet(nsize) * sizeof(MemUse)));
+  if (ns == NULL) return 0;
+  for (i = 0; i < nsize; i++)
+    ns[i].id = 0;
+  ma->uses = ns;
+  ma->sizeuses = nsize;
+  ma->nids = 0;
+  for (i = 0; i < oldsize; i++) {
+    if (old[i].id != 0)
+      insertuse(ma, old[i].id, old[i].bytes);
+  }
+  acctfree(g, old, cast_sizet(oldsize) * sizeof(MemUse));
+  return 1;
+}
+
+
+/*
+** Adds 'delta' bytes to the count of thread 'id', which must be in
+** 'uses'. A thread whose objects were all freed leaves the map,
+** shifting back following entries of the same cluster (as in
+** 'removesample').
+*/
+static void chargeuse (MemAccount *ma, ilya_Unsigned id, l_mem delta) {
+  MemUse *u = finduse(ma, id);
+  ilya_assert(u != NULL);
+  u->bytes += delta;
+  if (u->bytes == 0) {
+    unsigned int mask = cast_uint(ma->sizeuses - 1);
+    unsigned int i = cast_uint(u - ma->uses);
+    unsigned int j = i;
+    ma->nids--;
+    for (;;) {
+      unsigned int k;
+      j = (j + 1) & mask;
+      if (ma->uses[j].id == 0)
+        break;
+      k = idhash(ma->uses[j].id) & mask;
+      if ((i <= j) ? (i >= k || k > j) : (i >= k && k > j)) {
+        ma->uses[i] = ma->uses[j];
+        i = j;
+      }
+    }
+    ma->uses[i].id = 0;
+  }
+}
+
+
+/*
+** Records that the running thread created object 'o', with 'size'
+** bytes. If a map cannot grow, the object simply belongs to no thread.
+*/
+void ilyaM_acctnew (ilya_State *L, GCObject *o, size_t size) {
+  global_State *g = G(L);
+  MemAccount *ma = g->memacct;
+  MemUse *u;
+  if (2 * (ma->nuse + 1) > ma->size && !growowners(g, ma))
+    return;
+  u = finduse(ma, L->memid);
+  if (u == NULL) {  /* first live object of this thread? */
+    if (2 * (ma->nids + 1) > ma->sizeuses && !growuses(g, ma))
+      return;
+    u = insertuse(ma, L->memid, 0);
+  }
+  u->bytes += cast(l_mem, size);
+  insertowner(ma, o, L->memid, cast(l_mem, size));
+}
+
+
+/*
+** Object 'o' has now 'size' bytes; charge the difference to its owner.
+*/
+void ilyaM_acctsize (global_State *g, GCObject *o, l_mem size) {
+  MemAccount *ma = g->memacct;
+  MemOwner *s = findowner(ma, o);
+  if (s != NULL) {
+    chargeuse(ma, s->owner, size - s->size);
+    s->size = size;
+  }
+}
+
+
+/*
+** Object 'o' is being freed; discharge its owner and remove it from
+** the map, shifting back following entries of the same cluster (as in
+** 'removesample').
+*/
+void ilyaM_acctfree (global_State *g, GCObject *o) {
+  MemAccount *ma = g->memacct;
+  MemOwner *s = findowner(ma, o);
+  if (s != NULL) {
+    unsigned int mask = cast_uint(ma->size - 1);
+    unsigned int i = cast_uint(s - ma->slots);
+    unsigned int j = i;
+    chargeuse(ma, s->owner, -s->size);
+    ma->nuse--;
+    for (;;) {
+      unsigned int k;
+      j = (j + 1) & mask;
+      if (ma->slots[j].o == NULL)
+        break;
+      k = pointerhash(ma->slots[j].o) & mask;
+      if ((i <= j) ? (i >= k || k > j) : (i >= k && k > j)) {
+        ma->slots[i] = ma->slots[j];
+        i = j;
+      }
+    }
+    ma->slots[i].o = NULL;
+  }
+}
+
+
+/*
+** Returns the bytes charged for the live objects created by the thread
+** with id 'id'.
+*/
+l_mem ilyaM_acctbytes (global_State *g, ilya_Unsigned id) {
+  MemUse *u = finduse(g->memacct, id);
+  return (u != NULL) ? u->bytes : 0;
+}
+
+
+void ilyaM_freeaccount (ilya_State *L) {
+  global_State *g = G(L);
+  MemAccount *ma = g->memacct;
+  if (ma != NULL) {
+    g->memacct = NULL;
+    acctfree(g, ma->slots, cast_sizet(ma->size) * sizeof(MemOwner));
+    acctfree(g, ma->uses, cast_sizet(ma->sizeuses) * sizeof(MemUse));
+    acctfree(g, ma, sizeof(MemAccount));
+  }
+}
+
+
+/*
+** Turns accounting on (on > 0) or off (on == 0), or only queries it
+** (on < 0). Returns whether it was on.
+*/
+int ilyaM_setaccount (ilya_State *L, int on) {
+  global_State *g = G(L);
+  int old = (g->memacct != NULL);
+  if (on == 0)
+    ilyaM_freeaccount(L);
+  else if (on > 0 && !old) {
+    MemAccount *ma = cast(MemAccount *, acctalloc(g, sizeof(MemAccount)));
+    if (ma == NULL)
+      ilyaM_error(L);
+    ma->nuse = ma->size = 0;
+    ma->nids = ma->sizeuses = 0;
+    ma->slots = NULL;
+    ma->uses = NULL;
+    g->memacct = ma;
+  }
+  return old;
+}
+
+/* }================================================================== */
+
+
 /*
 ** Free memory
 */
 void ilyaM_free_ (ilya_State *L, void *block, size_t osize) {
   global_State *g = G(L);
   ilya_assert((osize == 0) == (block == NULL));
+  if (l_unlikely(g->memprof != NULL) && block != NULL)
+    profforget(g->memprof, block);
   callfrealloc(g, block, osize, 0);
   g->GCdebt += cast(l_mem, osize);
 }
@@ -176,7 +936,10 @@ static void *tryagain (ilya_State *L, void *block,
 void *ilyaM_realloc_ (ilya_State *L, void *block, size_t osize, size_t nsize) {
   void *newblock;
   global_State *g = G(L);
+  l_mem delta = cast(l_mem, nsize) - cast(l_mem, osize);
   ilya_assert((osize == 0) == (block == NULL));
+  if (overlimit(g, delta) && !makeroom(L, delta))
+    return NULL;  /* over the limit */
   newblock = firsttry(g, block, osize, nsize);
   if (l_unlikely(newblock == NULL && nsize > 0)) {
     newblock = tryagain(L, block, osize, nsize);
@@ -184,7 +947,11 @@ void *ilyaM_realloc_ (ilya_State *L, void *block, size_t osize, size_t nsize) {
       return NULL;  /* do not update 'GCdebt' */
   }
   ilya_assert((nsize == 0) == (newblock == NULL));
-  g->GCdebt -= cast(l_mem, nsize) - cast(l_mem, osize);
+  g->GCdebt -= delta;
+  if (delta > 0)
+    updatepeak(g);
+  if (l_unlikely(g->memprof != NULL))
+    profrealloc(L, block, newblock, osize, nsize);
   return newblock;
 }
 
@@ -203,13 +970,19 @@ void *ilyaM_malloc_ (ilya_State *L, size_t size, int tag) {
     return NULL;  /* that's all */
   else {
     global_State *g = G(L);
-    void *newblock = firsttry(g, NULL, cast_sizet(tag), size);
+    void *newblock;
+    if (overlimit(g, cast(l_mem, size)) && !makeroom(L, cast(l_mem, size)))
+      ilyaM_error(L);  /* over the limit */
+    newblock = firsttry(g, NULL, cast_sizet(tag), size);
     if (l_unlikely(newblock == NULL)) {
       newblock = tryagain(L, NULL, cast_sizet(tag), size);
       if (newblock == NULL)
         ilyaM_error(L);
     }
     g->GCdebt -= cast(l_mem, size);
+    updatepeak(g);
+    if (l_unlikely(g->memprof != NULL))
+      profmalloc(L, newblock, size, tag);
     return newblock;
   }
 }
@@ -91,5 +91,25 @@ ILYAI_FUNC void *ilyaM_shrinkvector_ (ilya_State *L, void *block, int *nelem,
                                     int final_n, unsigned size_elem);
 ILYAI_FUNC void *ilyaM_malloc_ (ilya_State *L, size_t size, int tag);
 
+typedef struct MemProfile MemProfile;
+
+ILYAI_FUNC int ilyaM_setprofile (ilya_State *L, int rate);
+ILYAI_FUNC void ilyaM_freeprofile (ilya_State *L);
+ILYAI_FUNC int ilyaM_profreport (ilya_State *L, int what, ilya_Writer writer,
+                                 void *data);
+
+typedef struct MemAccount MemAccount;
+struct GCObject;
+struct global_State;
+
+ILYAI_FUNC int ilyaM_setaccount (ilya_State *L, int on);
+ILYAI_FUNC void ilyaM_freeaccount (ilya_State *L);
+ILYAI_FUNC void ilyaM_acctnew (ilya_State *L, struct GCObject *o,
+                                size_t size);
+ILYAI_FUNC void ilyaM_acctsize (struct global_State *g, struct GCObject *o,
+                                l_mem size);
+ILYAI_FUNC void ilyaM_acctfree (struct global_State *g, struct GCObject *o);
+ILYAI_FUNC l_mem ilyaM_acctbytes (struct global_State *g, ilya_Unsigned id);
+
 #endif
 
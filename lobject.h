@@ -296,7 +296,11 @@ typedef union {
 
 /*
 ** Common Header for all collectable objects (in macro form, to be
-** included in other objects)
+** included in other objects). References between objects are plain
+** pointers: 32-bit offsets would need every collectable object to live
+** in one region owned by the core, but objects come from the user's
+** 'ilya_Alloc', which may place them anywhere. (Hash chains already use
+** offsets; see 'Node'.)
 */
 #define CommonHeader	struct GCObject *next; lu_byte tt; lu_byte marked
 
@@ -786,6 +786,7 @@ static void close_func (LexState *ls) {
   ilyaM_shrinkvector(L, f->p, f->sizep, fs->np, Proto *);
   ilyaM_shrinkvector(L, f->locvars, f->sizelocvars, fs->ndebugvars, LocVar);
   ilyaM_shrinkvector(L, f->upvalues, f->sizeupvalues, fs->nups, Upvaldesc);
+  ilyaC_acctsize(L, f);
   ls->fs = fs->prev;
   L->top.p--;  /* pop kcache table */
   ilyaC_checkGC(L);
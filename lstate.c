@@ -239,6 +239,9 @@ static void f_ilyaopen (ilya_State *L, void *ud) {
 */
 static void preinit_thread (ilya_State *L, global_State *g) {
   G(L) = g;
+  if (++g->lastmemid == 0)  /* wrapped around? (not with 64 bits) */
+    g->lastmemid = 1;  /* 0 means no thread */
+  L->memid = g->lastmemid;
   L->stack.p = NULL;
   L->ci = NULL;
   L->nci = 0;
@@ -276,9 +279,14 @@ static void close_state (ilya_State *L) {
     ilyaC_freeallobjects(L);  /* collect all objects */
     ilyai_userstateclose(L);
   }
-  ilyaM_freearray(L, G(L)->strt.hash, cast_sizet(G(L)->strt.size));
-  freestack(L);
-  ilya_assert(gettotalbytes(g) == sizeof(LG));
+  if (!g->arena) {  /* arena is released with the main block */
+    ilyaM_freeprofile(L);
+    ilyaM_freeaccount(L);
+    ilyaM_freearray(L, G(L)->strt.hash, cast_sizet(G(L)->strt.size));
+    ilyaM_freearray(L, G(L)->strt.old, cast_sizet(G(L)->strt.oldsize));
+    freestack(L);
+    ilya_assert(gettotalbytes(g) - g->GCexternal == sizeof(LG));
+  }
   (*g->frealloc)(g->ud, fromstate(L), sizeof(LG), 0);  /* free main block */
 }
 
@@ -349,7 +357,8 @@ ILYA_API int ilya_closethread (ilya_State *L, ilya_State *from) {
 }
 
 
-ILYA_API ilya_State *ilya_newstate (ilya_Alloc f, void *ud, unsigned seed) {
+static ilya_State *newstate (ilya_Alloc f, void *ud, unsigned seed,
+                             int arena) {
   int i;
   ilya_State *L;
   global_State *g;
@@ -360,6 +369,7 @@ ILYA_API ilya_State *ilya_newstate (ilya_Alloc f, void *ud, unsigned seed) {
   L->tt = ILYA_VTHREAD;
   g->currentwhite = bitmask(WHITE0BIT);
   L->marked = ilyaC_white(g);
+  g->lastmemid = 0;
   preinit_thread(L, g);
   g->allgc = obj2gco(L);  /* by now, only object is the main thread */
   L->next = NULL;
@@ -368,20 +378,31 @@ ILYA_API ilya_State *ilya_newstate (ilya_Alloc f, void *ud, unsigned seed) {
   g->ud = ud;
   g->warnf = NULL;
   g->ud_warn = NULL;
+  g->memprof = NULL;
+  g->memacct = NULL;
   g->mainthread = L;
   g->seed = seed;
   g->gcstp = GCSTPGC;  /* no GC while building state */
   g->strt.size = g->strt.nuse = 0;
-  g->strt.hash = NULL;
+  g->strt.hash = g->strt.old = NULL;
+  g->strt.oldsize = g->strt.moved = 0;
   setnilvalue(&g->l_registry);
   g->panic = NULL;
   g->gcstate = GCSpause;
   g->gckind = KGC_INC;
   g->gcstopem = 0;
   g->gcemergency = 0;
+  g->gcauto = 0;
+  g->arena = cast_byte(arena);
+  g->shrlimit = ILYAI_MAXSHORTLEN;
+  g->lngmin = ILYAI_MAXSHRLIMIT + 1;  /* no long strings yet */
   g->finobj = g->tobefnz = g->fixedgc = NULL;
   g->firstold1 = g->survival = g->old1 = g->reallyold = NULL;
   g->finobjsur = g->finobjold1 = g->finobjrold = NULL;
+  g->cardsets = NULL;
+  g->ncardsets = g->sizecardsets = 0;
+  g->travtable = NULL;
+  memset(&g->gcstats, 0, sizeof(g->gcstats));
   g->sweepgc = NULL;
   g->gray = g->grayagain = NULL;
   g->weak = g->ephemeron = g->allweak = NULL;
@@ -389,6 +410,9 @@ ILYA_API ilya_State *ilya_newstate (ilya_Alloc f, void *ud, unsigned seed) {
   g->GCtotalbytes = sizeof(LG);
   g->GCmarked = 0;
   g->GCdebt = 0;
+  g->memlimit = 0;
+  g->mempeak = sizeof(LG);
+  g->GCexternal = 0;
   setivalue(&g->nilvalue, 0);  /* to signal that state is not yet built */
   setgcparam(g, PAUSE, ILYAI_GCPAUSE);
   setgcparam(g, STEPMUL, ILYAI_GCMUL);
@@ -397,6 +421,8 @@ ILYA_API ilya_State *ilya_newstate (ilya_Alloc f, void *ud, unsigned seed) {
   setgcparam(g, MINORMAJOR, ILYAI_MINORMAJOR);
   setgcparam(g, MAJORMINOR, ILYAI_MAJORMINOR);
   for (i=0; i < ILYA_NUMTYPES; i++) g->mt[i] = NULL;
+  g->nextt = NULL;
+  g->nexti = 0;
   if (ilyaD_rawrunprotected(L, f_ilyaopen, NULL) != ILYA_OK) {
     /* memory allocation error: free partial state */
     close_state(L);
@@ -406,6 +432,22 @@ ILYA_API ilya_State *ilya_newstate (ilya_Alloc f, void *ud, unsigned seed) {
 }
 
 
+ILYA_API ilya_State *ilya_newstate (ilya_Alloc f, void *ud, unsigned seed) {
+  return newstate(f, ud, seed, 0);
+}
+
+
+/*
+** Create a state whose memory is released as a whole: when the state
+** is closed, its objects are finalized but not freed, and the last
+** call to the allocator frees the main block. The allocator must then
+** release everything it ever gave to this state.
+*/
+ILYA_API ilya_State *ilya_newarena (ilya_Alloc f, void *ud, unsigned seed) {
+  return newstate(f, ud, seed, 1);
+}
+
+
 ILYA_API void ilya_close (ilya_State *L) {
   ilya_lock(L);
   L = G(L)->mainthread;  /* only the main thread can be closed */
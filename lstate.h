@@ -166,8 +166,11 @@ struct ilya_longjmp;  /* defined in ldo.c */
 
 typedef struct stringtable {
   TString **hash;  /* array of buckets (linked lists of strings) */
+  TString **old;  /* previous array while resizing (or NULL) */
   int nuse;  /* number of elements */
   int size;  /* number of buckets */
+  int oldsize;  /* number of buckets in 'old' */
+  int moved;  /* buckets of 'old' already moved to 'hash' */
 } stringtable;
 
 
@@ -283,6 +286,36 @@ struct CallInfo {
 #define getoah(ci)  (((ci)->callstatus & CIST_OAH) ? 1 : 0)
 
 
+/*
+** Statistics of recent collections, used by the self-tuning ("auto")
+** mode of the collector and reported through option ILYA_GCSTAT. The
+** window keeps the last GCSWINDOW collections; pause sizes are
+** measured in bytes marked by each collector step, and their histogram
+** decays so that it reflects recent steps.
+*/
+#define GCSWINDOW	8
+
+typedef struct GCStats {
+  l_mem lasttotal;  /* bytes in use after the last collection */
+  l_mem stepwork;  /* bytes marked in the current step */
+  l_mem alloc[GCSWINDOW];  /* bytes allocated before each collection */
+  l_mem live[GCSWINDOW];  /* bytes marked by each collection */
+  lu_byte kind[GCSWINDOW];  /* kind of each collection */
+  int nwindow;  /* number of collections in the window */
+  int wnext;  /* next slot in the window */
+  l_mem count[3];  /* number of collections of each kind */
+  l_mem work[3];  /* bytes marked by collections of each kind */
+  l_mem pauses[ILYA_GCSNPAUSES];  /* histogram of step sizes */
+  l_mem nsteps;  /* number of steps in the histogram */
+  int switches;  /* mode switches done by the auto mode */
+  int probe;  /* incremental cycles before trying generational mode */
+  int waited;  /* incremental cycles since the last switch */
+  int minors;  /* minor collections since the last major one */
+  lu_byte decision;  /* last decision of the auto mode */
+  lu_byte pending;  /* collections finished since last decision? */
+} GCStats;
+
+
 /*
 ** 'global state', shared by all threads of this state
 */
@@ -292,6 +325,9 @@ typedef struct global_State {
   l_mem GCtotalbytes;  /* number of bytes currently allocated + debt */
   l_mem GCdebt;  /* bytes counted but not yet allocated */
   l_mem GCmarked;  /* number of objects marked in a GC cycle */
+  l_mem memlimit;  /* maximum bytes in use (0 means no limit) */
+  l_mem mempeak;  /* maximum bytes in use seen so far */
+  l_mem GCexternal;  /* bytes held outside the heap ('ilya_gcadjust') */
   l_mem GCmajorminor;  /* auxiliary counter to control major-minor shifts */
   stringtable strt;  /* hash table for strings */
   TValue l_registry;
@@ -304,6 +340,10 @@ typedef struct global_State {
   lu_byte gcstopem;  /* stops emergency collections */
   lu_byte gcstp;  /* control whether GC is running */
   lu_byte gcemergency;  /* true if this is an emergency collection */
+  lu_byte gcauto;  /* true if collector chooses its own mode */
+  lu_byte arena;  /* true if objects are not freed when closing state */
+  lu_byte shrlimit;  /* maximum length of short (internalized) strings */
+  lu_byte lngmin;  /* length of the shortest long string ever created */
   GCObject *allgc;  /* list of all collectable objects */
   GCObject **sweepgc;  /* current position of sweep in list */
   GCObject *finobj;  /* list of collectable objects with finalizers */
@@ -322,15 +362,30 @@ typedef struct global_State {
   GCObject *finobjsur;  /* list of survival objects with finalizers */
   GCObject *finobjold1;  /* list of old1 objects with finalizers */
   GCObject *finobjrold;  /* list of really old objects with finalizers */
+  struct CardSet **cardsets;  /* hash of card sets for large old tables */
+  int ncardsets;  /* number of card sets */
+  int sizecardsets;  /* size of 'cardsets' */
+  struct Table *travtable;  /* table being traversed in slices */
+  Node *travnode;  /* its hash part when the last slice ended */
+  Node *travfree;  /* its 'lastfree' when the last slice ended */
+  Node *travold;  /* its old hash part when the last slice ended */
+  unsigned int travasize;  /* its array size when the last slice ended */
+  unsigned int travpos;  /* where to resume its traversal */
+  GCStats gcstats;  /* statistics of recent collections */
   struct ilya_State *twups;  /* list of threads with open upvalues */
   ilya_CFunction panic;  /* to be called in unprotected errors */
   struct ilya_State *mainthread;
   TString *memerrmsg;  /* message for memory-allocation errors */
   TString *tmname[TM_N];  /* array with tag-method names */
   struct Table *mt[ILYA_NUMTYPES];  /* metatables for basic types */
+  struct Table *nextt;  /* table of the last 'next' in a hash part */
+  unsigned nexti;  /* node returned by that 'next' (see ltable.c) */
   TString *strcache[STRCACHE_N][STRCACHE_M];  /* cache for strings in API */
   ilya_WarnFunction warnf;  /* warning fn */
   void *ud_warn;         /* auxiliary data to 'warnf' */
+  struct MemProfile *memprof;  /* allocation profiler (NULL if off) */
+  struct MemAccount *memacct;  /* per-thread accounting (NULL if off) */
+  ilya_Unsigned lastmemid;  /* last 'memid' given to a thread */
 } global_State;
 
 
@@ -356,6 +411,7 @@ struct ilya_State {
   volatile ilya_Hook hook;
   ptrdiff_t errfunc;  /* current error handling fn (stack index) */
   l_uint32 nCcalls;  /* number of nested (non-yieldable | C)  calls */
+  ilya_Unsigned memid;  /* id for memory accounting (never 0) */
   int oldpc;  /* last pc traced */
   int basehookcount;
   int hookcount;
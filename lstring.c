@@ -38,6 +38,17 @@
 #endif
 
 
+/*
+** Number of buckets moved to the new vector of the string table in each
+** call to 'internshrstr' while the table is being resized. (A table
+** grows when it is full, to twice its size; moving one bucket per new
+** string is enough to finish the resize before the next one.)
+*/
+#if !defined(STRMIGRATE)
+#define STRMIGRATE	8
+#endif
+
+
 /*
 ** equality for long strings
 */
@@ -50,13 +61,90 @@ int ilyaS_eqlngstr (TString *a, TString *b) {
 }
 
 
+/*
+** {======================================================
+** String hash
+** =======================================================
+*/
+
+/*
+** The hash is xxHash32: strings of 16 bytes or more are consumed 16
+** bytes per iteration by four independent lanes (which compilers can
+** keep in one vector register), the rest 4 bytes at a time, and the
+** result goes through a final avalanche. Every bit of the seed, which
+** is random per state, affects the whole computation, so collisions
+** found for one state do not carry to another. Words are read in
+** native byte order, so hashes differ across platforms; they only
+** need to be stable inside a state.
+*/
+
+#define HPRIME1		0x9E3779B1u
+#define HPRIME2		0x85EBCA77u
+#define HPRIME3		0xC2B2AE3Du
+#define HPRIME4		0x27D4EB2Fu
+#define HPRIME5		0x165667B1u
+
+#define hrotl(x,n)	(((x) << (n)) | (((x) & 0xFFFFFFFFu) >> (32 - (n))))
+
+
+l_sinline l_uint32 getword (const char *p) {
+  l_uint32 w = 0;
+  memcpy(&w, p, 4);
+  return w;
+}
+
+
+l_sinline l_uint32 hround (l_uint32 v, l_uint32 w) {
+  v += w * HPRIME2;
+  v = hrotl(v, 13);
+  return v * HPRIME1;
+}
+
+
 unsigned ilyaS_hash (const char *str, size_t l, unsigned seed) {
-  unsigned int h = seed ^ cast_uint(l);
-  for (; l > 0; l--)
-    h ^= ((h<<5) + (h>>2) + cast_byte(str[l - 1]));
-  return h;
+  const char *p = str;
+  const char *end = str + l;
+  l_uint32 s = cast(l_uint32, seed);
+  l_uint32 h;
+  if (l >= 16) {
+    const char *lim = end - 16;
+    l_uint32 v1 = s + HPRIME1 + HPRIME2;
+    l_uint32 v2 = s + HPRIME2;
+    l_uint32 v3 = s;
+    l_uint32 v4 = s - HPRIME1;
+    do {
+      v1 = hround(v1, getword(p));
+      v2 = hround(v2, getword(p + 4));
+      v3 = hround(v3, getword(p + 8));
+      v4 = hround(v4, getword(p + 12));
+      p += 16;
+    } while (p <= lim);
+    h = hrotl(v1, 1) + hrotl(v2, 7) + hrotl(v3, 12) + hrotl(v4, 18);
+  }
+  else
+    h = s + HPRIME5;
+  h += cast(l_uint32, l);
+  for (; p + 4 <= end; p += 4) {
+    h += getword(p) * HPRIME3;
+    h = hrotl(h, 17) * HPRIME4;
+  }
+  for (; p < end; p++) {
+    h += cast_byte(*p) * HPRIME5;
+    h = hrotl(h, 11) * HPRIME1;
+  }
+  h &= 0xFFFFFFFFu;  /* avalanche */
+  h ^= h >> 15;
+  h *= HPRIME2;
+  h &= 0xFFFFFFFFu;
+  h ^= h >> 13;
+  h *= HPRIME3;
+  h &= 0xFFFFFFFFu;
+  h ^= h >> 16;
+  return cast_uint(h);
 }
 
+/* }====================================================== */
+
 
 unsigned ilyaS_hashlongstr (TString *ts) {
   ilya_assert(ts->tt == ILYA_VLNGSTR);
@@ -69,47 +157,76 @@ unsigned ilyaS_hashlongstr (TString *ts) {
 }
 
 
-static void tablerehash (TString **vect, int osize, int nsize) {
+static void clearvector (TString **vect, int size) {
   int i;
-  for (i = osize; i < nsize; i++)  /* clear new elements */
-    vect[i] = NULL;
-  for (i = 0; i < osize; i++) {  /* rehash old part of the array */
-    TString *p = vect[i];
+  for (i = 0; i < size; i++)
     vect[i] = NULL;
+}
+
+
+/*
+** Get the list where a string with hash 'h' is (or should go). While
+** the table is being resized, buckets of the old vector not moved yet
+** still hold their strings.
+*/
+static TString **strbucket (stringtable *tb, unsigned int h) {
+  if (tb->old != NULL) {  /* resize in progress? */
+    int i = cast_int(lmod(h, tb->oldsize));
+    if (i >= tb->moved)  /* bucket still in the old vector? */
+      return &tb->old[i];
+  }
+  return &tb->hash[lmod(h, tb->size)];
+}
+
+
+/*
+** Move up to 'n' buckets from the old vector of the string table to
+** the new one, freeing the old vector after its last bucket moves.
+*/
+void ilyaS_migrate (ilya_State *L, int n) {
+  stringtable *tb = &G(L)->strt;
+  if (tb->old == NULL)
+    return;  /* no resize in progress */
+  for (; n > 0 && tb->moved < tb->oldsize; n--) {
+    TString *p = tb->old[tb->moved];
+    tb->old[tb->moved++] = NULL;
     while (p) {  /* for each string in the list */
       TString *hnext = p->u.hnext;  /* save next */
-      unsigned int h = lmod(p->hash, nsize);  /* new position */
-      p->u.hnext = vect[h];  /* chain it into array */
-      vect[h] = p;
+      TString **list = &tb->hash[lmod(p->hash, tb->size)];
+      p->u.hnext = *list;  /* chain it into new vector */
+      *list = p;
       p = hnext;
     }
   }
+  if (tb->moved == tb->oldsize) {  /* all buckets moved? */
+    ilyaM_freearray(L, tb->old, cast_sizet(tb->oldsize));
+    tb->old = NULL;
+    tb->oldsize = tb->moved = 0;
+  }
 }
 
 
 /*
-** Resize the string table. If allocation fails, keep the current size.
-** (This can degrade performance, but any non-zero size should work
+** Resize the string table. The strings are not moved here: the new
+** vector starts empty, and 'ilyaS_migrate' moves the buckets of the
+** old one a few at a time, so that no single call pays for rehashing
+** the whole table. If allocation fails, keep the current size. (This
+** can degrade performance, but any non-zero size should work
 ** correctly.)
 */
 void ilyaS_resize (ilya_State *L, int nsize) {
   stringtable *tb = &G(L)->strt;
-  int osize = tb->size;
   TString **newvect;
-  if (nsize < osize)  /* shrinking table? */
-    tablerehash(tb->hash, osize, nsize);  /* depopulate shrinking part */
-  newvect = ilyaM_reallocvector(L, tb->hash, osize, nsize, TString*);
-  if (l_unlikely(newvect == NULL)) {  /* reallocation failed? */
-    if (nsize < osize)  /* was it shrinking table? */
-      tablerehash(tb->hash, nsize, osize);  /* restore to original size */
-    /* leave table as it was */
-  }
-  else {  /* allocation succeeded */
+  ilyaS_migrate(L, tb->oldsize);  /* finish previous resize */
+  newvect = ilyaM_reallocvector(L, NULL, 0, nsize, TString*);
+  if (l_likely(newvect != NULL)) {  /* allocation succeeded? */
+    clearvector(newvect, nsize);
+    tb->old = tb->hash;  /* current vector becomes the old one */
+    tb->oldsize = tb->size;
+    tb->moved = 0;
     tb->hash = newvect;
     tb->size = nsize;
-    if (nsize > osize)
-      tablerehash(newvect, osize, nsize);  /* rehash for new size */
-  }
+  }  /* else leave table as it was */
 }
 
 
@@ -135,7 +252,7 @@ void ilyaS_init (ilya_State *L) {
   int i, j;
   stringtable *tb = &G(L)->strt;
   tb->hash = ilyaM_newvector(L, MINSTRTABSIZE, TString*);
-  tablerehash(tb->hash, 0, MINSTRTABSIZE);  /* clear array */
+  clearvector(tb->hash, MINSTRTABSIZE);
   tb->size = MINSTRTABSIZE;
   /* pre-create memory-error message */
   g->memerrmsg = ilyaS_newliteral(L, MEMERRMSG);
@@ -176,9 +293,18 @@ static TString *createstrobj (ilya_State *L, size_t totalsize, lu_byte tag,
 }
 
 
+/*
+** Record the length of a new long string, so that the limit for short
+** strings is never raised past it (see 'ilyaS_setshrlimit').
+*/
+#define marklnglen(g,l)  \
+	{ if ((l) < (g)->lngmin) (g)->lngmin = cast_byte(l); }
+
+
 TString *ilyaS_createlngstrobj (ilya_State *L, size_t l) {
   size_t totalsize = ilyaS_sizelngstr(l, LSTRREG);
   TString *ts = createstrobj(L, totalsize, ILYA_VLNGSTR, G(L)->seed);
+  marklnglen(G(L), l);
   ts->u.lnglen = l;
   ts->shrlen = LSTRREG;  /* signals that it is a regular long string */
   ts->contents = cast_charp(ts) + offsetof(TString, falloc);
@@ -189,7 +315,7 @@ TString *ilyaS_createlngstrobj (ilya_State *L, size_t l) {
 
 void ilyaS_remove (ilya_State *L, TString *ts) {
   stringtable *tb = &G(L)->strt;
-  TString **p = &tb->hash[lmod(ts->hash, tb->size)];
+  TString **p = strbucket(tb, ts->hash);
   while (*p != ts)  /* find previous element */
     p = &(*p)->u.hnext;
   *p = (*p)->u.hnext;  /* remove element from its list */
@@ -216,7 +342,10 @@ static TString *internshrstr (ilya_State *L, const char *str, size_t l) {
   global_State *g = G(L);
   stringtable *tb = &g->strt;
   unsigned int h = ilyaS_hash(str, l, g->seed);
-  TString **list = &tb->hash[lmod(h, tb->size)];
+  TString **list;
+  if (tb->old != NULL)  /* resize in progress? */
+    ilyaS_migrate(L, STRMIGRATE);  /* move a few more buckets */
+  list = strbucket(tb, h);
   ilya_assert(str != NULL);  /* otherwise 'memcmp'/'memcpy' are undefined */
   for (ts = *list; ts != NULL; ts = ts->u.hnext) {
     if (l == cast_uint(ts->shrlen) &&
@@ -228,14 +357,15 @@ static TString *internshrstr (ilya_State *L, const char *str, size_t l) {
     }
   }
   /* else must create a new string */
-  if (tb->nuse >= tb->size) {  /* need to grow string table? */
+  if (tb->nuse >= tb->size)  /* need to grow string table? */
     growstrtab(L, tb);
-    list = &tb->hash[lmod(h, tb->size)];  /* rehash with new size */
-  }
   ts = createstrobj(L, sizestrshr(l), ILYA_VSHRSTR, h);
   ts->shrlen = cast(ls_byte, l);
   getshrstr(ts)[l] = '\0';  /* ending 0 */
   memcpy(getshrstr(ts), str, l * sizeof(char));
+  /* table may have a new vector, and 'createstrobj' may have run an
+     emergency collection */
+  list = strbucket(tb, h);
   ts->u.hnext = *list;
   *list = ts;
   tb->nuse++;
@@ -247,7 +377,7 @@ static TString *internshrstr (ilya_State *L, const char *str, size_t l) {
 ** new string (with explicit length)
 */
 TString *ilyaS_newlstr (ilya_State *L, const char *str, size_t l) {
-  if (l <= ILYAI_MAXSHORTLEN)  /* short string? */
+  if (l <= shrlimit(L))  /* short string? */
     return internshrstr(L, str, l);
   else {
     TString *ts;
@@ -283,6 +413,24 @@ TString *ilyaS_new (ilya_State *L, const char *str) {
 }
 
 
+/*
+** Set the maximum length for short strings. Equal strings must all be
+** short or all be long, so the limit can only grow, and only below the
+** length of every long string created so far. Returns the limit in
+** effect.
+*/
+int ilyaS_setshrlimit (ilya_State *L, int limit) {
+  global_State *g = G(L);
+  if (limit > ILYAI_MAXSHRLIMIT)
+    limit = ILYAI_MAXSHRLIMIT;
+  if (limit >= g->lngmin)
+    limit = g->lngmin - 1;  /* cannot make existing long strings short */
+  if (limit > g->shrlimit)
+    g->shrlimit = cast_byte(limit);
+  return g->shrlimit;
+}
+
+
 Udata *ilyaS_newudata (ilya_State *L, size_t s, unsigned short nuvalue) {
   Udata *u;
   int i;
@@ -324,7 +472,7 @@ static void f_pintern (ilya_State *L, void *ud) {
 TString *ilyaS_newextlstr (ilya_State *L,
 	          const char *s, size_t len, ilya_Alloc falloc, void *ud) {
   struct NewExt ne;
-  if (len <= ILYAI_MAXSHORTLEN) {  /* short string? */
+  if (len <= shrlimit(L)) {  /* short string? */
     ne.s = s; ne.len = len;
     if (!falloc)
       f_pintern(L, &ne);  /* just internalize string */
@@ -350,6 +498,7 @@ TString *ilyaS_newextlstr (ilya_State *L,
     ne.ts->falloc = falloc;
     ne.ts->ud = ud;
   }
+  marklnglen(G(L), len);
   ne.ts->shrlen = ne.kind;
   ne.ts->u.lnglen = len;
   ne.ts->contents = cast_charp(s);
@@ -29,6 +29,18 @@
 #define ILYAI_MAXSHORTLEN	40
 #endif
 
+/*
+** 'ILYAI_MAXSHORTLEN' is only the initial limit of each state; an
+** embedder can raise it (see 'ilya_internlimit') up to this value,
+** which must fit in 'shrlen'.
+*/
+#if !defined(ILYAI_MAXSHRLIMIT)
+#define ILYAI_MAXSHRLIMIT	120
+#endif
+
+/* maximum length for short strings in a state */
+#define shrlimit(L)	(G(L)->shrlimit)
+
 
 /*
 ** Size of a short TString: Size of the header plus space for the string
@@ -58,6 +70,8 @@ ILYAI_FUNC unsigned ilyaS_hash (const char *str, size_t l, unsigned seed);
 ILYAI_FUNC unsigned ilyaS_hashlongstr (TString *ts);
 ILYAI_FUNC int ilyaS_eqlngstr (TString *a, TString *b);
 ILYAI_FUNC void ilyaS_resize (ilya_State *L, int newsize);
+ILYAI_FUNC void ilyaS_migrate (ilya_State *L, int n);
+ILYAI_FUNC int ilyaS_setshrlimit (ilya_State *L, int limit);
 ILYAI_FUNC void ilyaS_clearcache (global_State *g);
 ILYAI_FUNC void ilyaS_init (ilya_State *L);
 ILYAI_FUNC void ilyaS_remove (ilya_State *L, TString *ts);
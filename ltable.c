@@ -21,12 +21,18 @@
 ** in its main position (i.e. the 'original' position that its hash gives
 ** to it), then the colliding element is in its own main position.
 ** Hence even when the load factor reaches 100%, performance remains good.
+** (With ILYA_SWISSHASH, the hash part uses open addressing instead;
+** see "Swiss hash part" below.)
 */
 
 #include <math.h>
 #include <limits.h>
 #include <string.h>
 
+#if defined(ILYA_SWISSHASH) && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "ilya.h"
 
 #include "ldebug.h"
@@ -49,18 +55,51 @@
 #define LIMFORLAST    3  /* log2 of real limit (8) */
 
 /*
-** The union 'Limbox' stores 'lastfree' and ensures that what follows it
-** is properly aligned to store a Node.
+** A hash part with at least 2^LIMFORMOVE nodes does not grow all at
+** once: the new hash part keeps a pointer to the old one, and each
+** insertion moves MOVESTEP old nodes into the new part. Meanwhile,
+** searches that miss the new part look in the old one. The new part
+** has at least twice the size of the old one, so it has room for all
+** old entries plus the new keys inserted until the old part is empty
+** (one for each MOVESTEP old nodes).
 */
-typedef struct { Node *dummy; Node follows_pNode; } Limbox_aux;
+#define LIMFORMOVE    16  /* log2 of real limit (65536) */
+#define MOVESTEP      8
 
-typedef union {
+/*
+** The union 'Limbox' stores 'lastfree', with the state of a growth in
+** progress and a hint for borders in the hash part, and ensures that
+** what follows it is properly aligned to store a Node.
+*/
+typedef struct {
   Node *lastfree;
+  ilya_Unsigned border;  /* last border found in the hash part, or 0 */
+  Node *oldnode;  /* old hash part being moved into this one, or NULL */
+  unsigned oldpos;  /* index of its next node to be moved */
+  lu_byte oldlsize;  /* log2 of its size */
+} Limfields;
+
+typedef struct { Limfields dummy; Node follows_pNode; } Limbox_aux;
+
+typedef union {
+  Limfields c;
+  unsigned growth;  /* nodes that can still be used (Swiss layout) */
   char padding[offsetof(Limbox_aux, follows_pNode)];
 } Limbox;
 
+#define limbox(t)	(cast(Limbox *, (t)->node) - 1)
+
+#if !defined(ILYA_SWISSHASH)
 #define haslastfree(t)     ((t)->lsizenode >= LIMFORLAST)
-#define getlastfree(t)     ((cast(Limbox *, (t)->node) - 1)->lastfree)
+#define haslimbox(t)	haslastfree(t)
+/* is the table still moving nodes from an old hash part? */
+#define ismoving(t)	(haslastfree(t) && limbox(t)->c.oldnode != NULL)
+#else
+#define haslastfree(t)     0
+#define haslimbox(t)	(!isdummy(t))
+#define ismoving(t)	0
+#endif
+#define getlastfree(t)     (limbox(t)->c.lastfree)
 
 
 /*
@@ -119,6 +158,8 @@ typedef union {
 #define hashpointer(t,p)	hashmod(t, point2uint(p))
 
 
+#if !defined(ILYA_SWISSHASH)
+
 #define dummynode		(&dummynode_)
 
 /*
@@ -132,6 +173,10 @@ static const Node dummynode_ = {
    ILYA_TDEADKEY, 0, {NULL}}  /* key type, next, and key value */
 };
 
+ILYAI_DDEF const Node *const ilyaH_dummynode = dummynode;
+
+#endif
+
 
 static const TValue absentkey = {ABSTKEYCONSTANT};
 
@@ -273,11 +318,301 @@ static int equalkey (const TValue *k1, const Node *n2, int deadok) {
 }
 
 
+static void newcheckedkey (Table *t, const TValue *key, TValue *value);
+
+
+#if defined(ILYA_SWISSHASH)
+/*
+** {=============================================================
+** Swiss hash part
+** ==============================================================
+*/
+
+/*
+** With ILYA_SWISSHASH, the hash part uses open addressing. Nodes keep
+** their layout (their 'next' fields are unused), but the block that
+** holds them starts with one control byte per node: CTRLEMPTY for a
+** free node or 7 bits of the key's hash for a used one. A search
+** compares GROUPSIZE control bytes at a time (with SSE2, in one
+** instruction), starting at the key's main position, looks only at
+** nodes whose bytes match, and stops at the first group with a free
+** node. As in the chained layout, a removed key keeps its node (with
+** an empty value) until the next rehash, so nodes never move and no
+** deletion marks are needed. The control bytes of the first
+** GROUPSIZE - 1 nodes are repeated after the last one, so that groups
+** near the end wrap around; tables smaller than a group repeat them
+** as many times as needed to fill it. The block is laid out as
+** [control bytes | Limbox (with 'growth') | nodes].
+*/
+
+#define GROUPSIZE	16
+#define CTRLEMPTY	0x80
+
+/* space for the control bytes, keeping nodes aligned */
+#define ctrlspace(size)	(((size) + GROUPSIZE - 1 + 15) & ~cast_uint(15))
+
+#define getctrl(t)  \
+	(cast(lu_byte *, limbox(t)) - ctrlspace(sizenode(t)))
+
+#define getgrowth(t)	(limbox(t)->growth)
+
+/*
+** Maximum number of used nodes in a hash part with 'size' nodes. Small
+** parts may be full; larger ones keep 1/8 free to bound searches.
+*/
+#define maxfill(size)	((size) <= 8 ? (size) : (size) - ((size) >> 3))
+
+/*
+** A key's raw hash is mixed (a multiplication by the golden ratio);
+** the top bits of the result give the key's position, so that
+** sequential integers do not fill consecutive nodes, and its low 7
+** bits give the key's control byte.
+*/
+#define mixhash(h)	cast_uint((cast_uint(h) * 0x9E3779B1u) & 0xFFFFFFFFu)
+#define mixpos(t,m)	(((m) >> 1) >> (31 - (t)->lsizenode))
+#define mixfrag(m)	cast_byte((m) & 0x7F)
+
+#define inthash(i)  \
+	cast_uint(l_castS2U(i) ^ (l_castS2U(i) >> (sizeof(ilya_Integer) * 4)))
+
+
+#if defined(__SSE2__)
+
+/* bit mask of the bytes in group 'g' equal to 'b' */
+static unsigned matchgroup (const lu_byte *g, lu_byte b) {
+  __m128i v = _mm_loadu_si128(cast(const __m128i *, g));
+  return cast_uint(_mm_movemask_epi8(
+                     _mm_cmpeq_epi8(v, _mm_set1_epi8(cast(char, b)))));
+}
+
+/* bit mask of the free nodes in group 'g' (the only high bits) */
+static unsigned emptygroup (const lu_byte *g) {
+  __m128i v = _mm_loadu_si128(cast(const __m128i *, g));
+  return cast_uint(_mm_movemask_epi8(v));
+}
+
+#else
+
+static unsigned matchgroup (const lu_byte *g, lu_byte b) {
+  unsigned m = 0;
+  int i;
+  for (i = 0; i < GROUPSIZE; i++) {
+    if (g[i] == b)
+      m |= 1u << i;
+  }
+  return m;
+}
+
+#define emptygroup(g)	matchgroup(g, CTRLEMPTY)
+
+#endif
+
+
+/* index of the lowest bit set in 'm' (which is not zero) */
+#if defined(__GNUC__)
+#define lowbit(m)	cast_uint(__builtin_ctz(m))
+#else
+static unsigned lowbit (unsigned m) {
+  unsigned i = 0;
+  while (!(m & 1u)) { m >>= 1; i++; }
+  return i;
+}
+#endif
+
+
+/*
+** Common hash part for tables with empty hash parts. Its control bytes
+** are all free, so searches stop at once; its sole node is as in the
+** chained layout.
+*/
+static const struct {
+  lu_byte ctrl[GROUPSIZE];
+  Limbox box;
+  Node node;
+} dummyblock_ = {
+  {CTRLEMPTY, CTRLEMPTY, CTRLEMPTY, CTRLEMPTY, CTRLEMPTY, CTRLEMPTY,
+   CTRLEMPTY, CTRLEMPTY, CTRLEMPTY, CTRLEMPTY, CTRLEMPTY, CTRLEMPTY,
+   CTRLEMPTY, CTRLEMPTY, CTRLEMPTY, CTRLEMPTY},
+  {{NULL}},
+  {{{NULL}, ILYA_VEMPTY, ILYA_TDEADKEY, 0, {NULL}}}
+};
+
+#define dummynode		(&dummyblock_.node)
+
+ILYAI_DDEF const Node *const ilyaH_dummynode = dummynode;
+
+
+static unsigned keyhash (const TValue *key) {
+  switch (ttypetag(key)) {
+    case ILYA_VNUMINT:
+      return inthash(ivalue(key));
+    case ILYA_VNUMFLT:
+      return l_hashfloat(fltvalue(key));
+    case ILYA_VSHRSTR:
+      return tsvalue(key)->hash;
+    case ILYA_VLNGSTR:
+      return ilyaS_hashlongstr(tsvalue(key));
+    case ILYA_VFALSE:
+      return 0;
+    case ILYA_VTRUE:
+      return 1;
+    case ILYA_VLIGHTUSERDATA:
+      return point2uint(pvalue(key));
+    case ILYA_VLCF:
+      return point2uint(fvalue(key));
+    default:
+      return point2uint(gcvalue(key));
+  }
+}
+
+
+/* set control byte of node 'i' and its copies */
+static void setctrl (Table *t, unsigned i, lu_byte c) {
+  lu_byte *ctrl = getctrl(t);
+  unsigned size = sizenode(t);
+  for (; i < size + GROUPSIZE - 1; i += size)
+    ctrl[i] = c;
+}
+
+
+/*
+** Search loop shared by all lookups: 'cond' tests node 'n' against
+** the key whose mixed hash is 'h'.
+*/
+#define swisssearch(t,h,n,cond)  \
+  { const lu_byte *ctrl_ = getctrl(t); \
+    unsigned i = mixpos(t, h); \
+    lu_byte frag = mixfrag(h); \
+    unsigned mask_ = sizenode(t) - 1; \
+    unsigned ng_ = (mask_ / GROUPSIZE) + 1;  /* groups in the table */ \
+    do { \
+      unsigned m_ = matchgroup(ctrl_ + i, frag); \
+      while (m_ != 0) { \
+        n = gnode(t, (i + lowbit(m_)) & mask_); \
+        if (cond) return gval(n); \
+        m_ &= m_ - 1; \
+      } \
+      if (emptygroup(ctrl_ + i)) break;  /* key would be in this group */ \
+      i = (i + GROUPSIZE) & mask_; \
+    } while (--ng_ > 0); \
+    return &absentkey; }
+
+
+static const TValue *getgeneric (Table *t, const TValue *key, int deadok) {
+  unsigned h = mixhash(keyhash(key));
+  Node *n;
+  swisssearch(t, h, n, equalkey(key, n, deadok));
+}
+
+
+static const TValue *getintfromhash (Table *t, ilya_Integer key) {
+  unsigned h = mixhash(inthash(key));
+  Node *n;
+  swisssearch(t, h, n, keyisinteger(n) && keyival(n) == key);
+}
+
+
+const TValue *ilyaH_Hgetshortstr (Table *t, TString *key) {
+  unsigned h = mixhash(key->hash);
+  Node *n;
+  ilya_assert(strisshr(key));
+  swisssearch(t, h, n, keyisshrstr(n) && eqshrstr(keystrval(n), key));
+}
+
+
+static void setnodevector (ilya_State *L, Table *t, unsigned size) {
+  if (size == 0) {  /* no elements to hash part? */
+    t->node = cast(Node *, dummynode);  /* use common 'dummynode' */
+    t->lsizenode = 0;
+  }
+  else {
+    unsigned i;
+    char *block;
+    int lsize = ilyaO_ceillog2(size);
+    if (lsize < MAXHBITS && maxfill(twoto(lsize)) < size)
+      lsize++;  /* keep some nodes free */
+    if (lsize > MAXHBITS || (1 << lsize) > MAXHSIZE)
+      ilyaG_runerror(L, "table overflow");
+    size = twoto(lsize);
+    block = ilyaM_newblock(L, ctrlspace(size) + sizeof(Limbox)
+                              + size * sizeof(Node));
+    memset(block, CTRLEMPTY, ctrlspace(size));
+    t->node = cast(Node *, block + ctrlspace(size) + sizeof(Limbox));
+    t->lsizenode = cast_byte(lsize);
+    getgrowth(t) = maxfill(size);
+    limbox(t)->c.border = 0;  /* no hint */
+    for (i = 0; i < size; i++) {
+      Node *n = gnode(t, i);
+      gnext(n) = 0;
+      setnilkey(n);
+      setempty(gval(n));
+    }
+  }
+}
+
+
+/*
+** Nodes never move, so the node vector itself works as the mark that
+** changes when entries may have moved (that is, on resizes).
+*/
+Node *ilyaH_lastfree (Table *t) {
+  return isdummy(t) ? NULL : t->node;
+}
+
+
+/*
+** Inserts a new key into the first free node after its main position.
+** Return 0 if the table has no room left for it.
+*/
+static int insertkey (Table *t, const TValue *key, TValue *value) {
+  const lu_byte *ctrl;
+  unsigned mask, h, i, m;
+  Node *n;
+  /* table cannot already contain the key */
+  ilya_assert(isabstkey(getgeneric(t, key, 0)));
+  if (isdummy(t) || getgrowth(t) == 0)
+    return 0;
+  ctrl = getctrl(t);
+  mask = sizenode(t) - 1;
+  h = mixhash(keyhash(key));
+  i = mixpos(t, h);
+  while ((m = emptygroup(ctrl + i)) == 0)  /* 'growth' ensures a free node */
+    i = (i + GROUPSIZE) & mask;
+  i = (i + lowbit(m)) & mask;
+  setctrl(t, i, mixfrag(h));
+  getgrowth(t)--;
+  n = gnode(t, i);
+  setnodekey(n, key);
+  ilya_assert(isempty(gval(n)));
+  setobj2t(cast(ilya_State *, 0), gval(n), value);
+  return 1;
+}
+
+/* }============================================================= */
+
+#endif
+
+
+/*
+** Make 'old' a view of the old hash part of table 't', to handle it
+** with the usual functions.
+*/
+static Table *oldpart (Table *t, Table *old) {
+  old->node = limbox(t)->c.oldnode;
+  old->lsizenode = limbox(t)->c.oldlsize;
+  return old;
+}
+
+
 /*
 ** "Generic" get version. (Not that generic: not valid for integers,
 ** which may be in array part, nor for floats with integral values.)
 ** See explanation about 'deadok' in fn 'equalkey'.
 */
+#if !defined(ILYA_SWISSHASH)
+
+static const TValue *getold (Table *t, const TValue *key, int deadok);
+
 static const TValue *getgeneric (Table *t, const TValue *key, int deadok) {
   Node *n = mainpositionTV(t, key);
   for (;;) {  /* check whether 'key' is somewhere in the chain */
@@ -285,14 +620,44 @@ static const TValue *getgeneric (Table *t, const TValue *key, int deadok) {
       return gval(n);  /* that's it */
     else {
       int nx = gnext(n);
-      if (nx == 0)
-        return &absentkey;  /* not found */
+      if (nx == 0)  /* not found? */
+        return l_unlikely(ismoving(t)) ? getold(t, key, deadok) : &absentkey;
       n += nx;
     }
   }
 }
 
 
+/*
+** Search 'key' in the old hash part of table 't', which is still being
+** moved into its new part. Moved nodes keep their keys with empty
+** values, so an empty value there means an absent key, except for
+** traversals (see 'deadok').
+*/
+static const TValue *getold (Table *t, const TValue *key, int deadok) {
+  Table old;
+  const TValue *res = getgeneric(oldpart(t, &old), key, deadok);
+  return (isempty(res) && !deadok) ? &absentkey : res;
+}
+
+#endif
+
+
+/*
+** Returns the old hash part of a table that is still being moved into
+** its new part, and sets 'size' with its size; returns NULL if there
+** is none.
+*/
+Node *ilyaH_oldnodes (const Table *t, unsigned *size) {
+  if (ismoving(t)) {
+    *size = twoto(limbox(t)->c.oldlsize);
+    return limbox(t)->c.oldnode;
+  }
+  *size = 0;
+  return NULL;
+}
+
+
 /*
 ** Return the index 'k' (converted to an unsigned) if it is inside
 ** the range [1, limit].
@@ -327,8 +692,13 @@ static unsigned keyinarray (Table *t, const TValue *key) {
 
 /*
 ** returns the index of a 'key' for table traversals. First goes all
-** elements in the array part, then elements in the hash part. The
-** beginning of a traversal is signaled by 0.
+** elements in the array part, then elements in the hash part (with
+** the nodes of an old hash part still being moved after the others),
+** then slots. The beginning of a traversal is signaled by 0.
+** A traversal usually calls 'next' with the key that the previous call
+** returned, so the state remembers the node of that key and checks it
+** before searching the hash part. ('nextt' is only compared, never
+** dereferenced; it may point to a table that was already collected.)
 */
 static unsigned findindex (ilya_State *L, Table *t, TValue *key,
                                unsigned asize) {
@@ -337,11 +707,29 @@ static unsigned findindex (ilya_State *L, Table *t, TValue *key,
   i = keyinarray(t, key);
   if (i != 0)  /* is 'key' inside array part? */
     return i;  /* yes; that's the index */
+  else if (G(L)->nextt == t && (i = G(L)->nexti) < sizenode(t) &&
+           equalkey(key, gnode(t, i), 0))  /* key from the last 'next'? */
+    return (i + 1) + asize;
   else {
+    Node *old;
+    unsigned osize;
+#if !defined(ILYA_SWISSHASH)
     const TValue *n = getgeneric(t, key, 1);
+#else
+    /* nodes of removed keys are not reused, so a dead key may have
+       the same identity as a live one in another node; prefer the
+       live one */
+    const TValue *n = getgeneric(t, key, 0);
+    if (isabstkey(n))
+      n = getgeneric(t, key, 1);
+#endif
     if (l_unlikely(isabstkey(n)))
       ilyaG_runerror(L, "invalid key to 'next'");  /* key not found */
-    i = cast_uint(nodefromval(n) - gnode(t, 0));  /* key index in hash table */
+    old = ilyaH_oldnodes(t, &osize);
+    if (old != NULL && old <= nodefromval(n) && nodefromval(n) < old + osize)
+      i = sizenode(t) + cast_uint(nodefromval(n) - old);  /* in old part */
+    else
+      i = cast_uint(nodefromval(n) - gnode(t, 0));  /* index in hash part */
     /* hash elements are numbered after array ones */
     return (i + 1) + asize;
   }
@@ -364,26 +752,45 @@ int ilyaH_next (ilya_State *L, Table *t, StkId key) {
       Node *n = gnode(t, i);
       getnodekey(L, s2v(key), n);
       setobj2s(L, key + 1, gval(n));
+      G(L)->nextt = t;  /* next call probably continues from here */
+      G(L)->nexti = i;
       return 1;
     }
   }
+  i -= sizenode(t);
+  if (l_unlikely(ismoving(t))) {
+    unsigned osize;
+    Node *old = ilyaH_oldnodes(t, &osize);
+    for (; i < osize; i++) {  /* old hash part */
+      if (!isempty(gval(old + i))) {  /* a non-empty entry? */
+        getnodekey(L, s2v(key), old + i);
+        setobj2s(L, key + 1, gval(old + i));
+        return 1;
+      }
+    }
+    i -= osize;
+  }
   return 0;  /* no more elements */
 }
 
 
 /* Extra space in Node array if it has a lastfree entry */
-#define extraLastfree(t)	(haslastfree(t) ? sizeof(Limbox) : 0)
+#if !defined(ILYA_SWISSHASH)
+#define extrahash(t)	(haslastfree(t) ? sizeof(Limbox) : 0)
+#else
+#define extrahash(t)	(ctrlspace(sizenode(t)) + sizeof(Limbox))
+#endif
 
 /* 'node' size in bytes */
 static size_t sizehash (Table *t) {
-  return cast_sizet(sizenode(t)) * sizeof(Node) + extraLastfree(t);
+  return cast_sizet(sizenode(t)) * sizeof(Node) + extrahash(t);
 }
 
 
 static void freehash (ilya_State *L, Table *t) {
   if (!isdummy(t)) {
     /* get pointer to the beginning of Node array */
-    char *arr = cast_charp(t->node) - extraLastfree(t);
+    char *arr = cast_charp(t->node) - extrahash(t);
     ilyaM_freearray(L, arr, sizehash(t));
   }
 }
@@ -395,8 +802,9 @@ static void freehash (ilya_State *L, Table *t) {
 ** ==============================================================
 */
 
+#if !defined(ILYA_SWISSHASH)
 static int insertkey (Table *t, const TValue *key, TValue *value);
-static void newcheckedkey (Table *t, const TValue *key, TValue *value);
+#endif
 
 
 /*
@@ -504,9 +912,10 @@ static void numusearray (const Table *t, Counters *ct) {
 
 
 /*
-** Count keys in hash part of table 't'. As this only happens during
-** a rehash, all nodes have been used. A node can have a nil value only
-** if it was deleted after being created.
+** Count keys in hash part of table 't'. During a rehash, all nodes
+** have been used, so a node can have a nil value only if it was
+** deleted after being created. (When shrinking a table, free nodes
+** have nil keys.)
 */
 static void numusehash (const Table *t, Counters *ct) {
   unsigned i = sizenode(t);
@@ -514,8 +923,8 @@ static void numusehash (const Table *t, Counters *ct) {
   while (i--) {
     Node *n = &t->node[i];
     if (isempty(gval(n))) {
-      ilya_assert(!keyisnil(n));  /* entry was deleted; key cannot be nil */
-      ct->deleted = 1;
+      if (!keyisnil(n))  /* entry was deleted? */
+        ct->deleted = 1;
     }
     else {
       total++;
@@ -589,11 +998,12 @@ static Value *resizearray (ilya_State *L , Table *t,
 ** comparison ensures that the shift in the second one does not
 ** overflow.
 */
+#if !defined(ILYA_SWISSHASH)
+
 static void setnodevector (ilya_State *L, Table *t, unsigned size) {
   if (size == 0) {  /* no elements to hash part? */
     t->node = cast(Node *, dummynode);  /* use common 'dummynode' */
     t->lsizenode = 0;
-    setdummy(t);  /* signal that it is using dummy node */
   }
   else {
     int i;
@@ -608,9 +1018,10 @@ static void setnodevector (ilya_State *L, Table *t, unsigned size) {
       char *node = ilyaM_newblock(L, bsize);
       t->node = cast(Node *, node + sizeof(Limbox));
       getlastfree(t) = gnode(t, size);  /* all positions are free */
+      limbox(t)->c.oldnode = NULL;  /* nothing to move */
+      limbox(t)->c.border = 0;  /* no hint */
     }
     t->lsizenode = cast_byte(lsize);
-    setnodummy(t);
     for (i = 0; i < cast_int(size); i++) {
       Node *n = gnode(t, i);
       gnext(n) = 0;
@@ -620,6 +1031,8 @@ static void setnodevector (ilya_State *L, Table *t, unsigned size) {
   }
 }
 
+#endif
+
 
 /*
 ** (Re)insert all elements from the hash part of 'ot' into table 't'.
@@ -641,21 +1054,74 @@ static void reinserthash (ilya_State *L, Table *ot, Table *t) {
 
 
 /*
-** Exchange the hash part of 't1' and 't2'. (In 'flags', only the
-** dummy bit must be exchanged: The 'isrealasize' is not related
-** to the hash part, and the metamethod bits do not change during
-** a resize, so the "real" table can keep their values.)
+** Exchange the hash part of 't1' and 't2'. ('flags' need no exchange:
+** the metamethod bits do not change during a resize, so the "real"
+** table can keep their values.)
 */
 static void exchangehashpart (Table *t1, Table *t2) {
   lu_byte lsizenode = t1->lsizenode;
   Node *node = t1->node;
-  int bitdummy1 = t1->flags & BITDUMMY;
   t1->lsizenode = t2->lsizenode;
   t1->node = t2->node;
-  t1->flags = cast_byte((t1->flags & NOTBITDUMMY) | (t2->flags & BITDUMMY));
   t2->lsizenode = lsizenode;
   t2->node = node;
-  t2->flags = cast_byte((t2->flags & NOTBITDUMMY) | bitdummy1);
+}
+
+
+/*
+** Move up to 'n' nodes from the old hash part of table 't' into its
+** new part, freeing the old part when all its nodes were moved. The
+** values moved are emptied in the old part, so that searches do not
+** find them there.
+*/
+static void movenodes (ilya_State *L, Table *t, unsigned n) {
+  Table old;
+  unsigned size = sizenode(oldpart(t, &old));
+  unsigned i = limbox(t)->c.oldpos;
+  unsigned lim = (size - i > n) ? i + n : size;
+  for (; i < lim; i++) {
+    Node *o = gnode(&old, i);
+    if (!isempty(gval(o))) {
+      TValue k, v;
+      getnodekey(L, &k, o);
+      setobj(L, &v, gval(o));
+      setempty(gval(o));
+      newcheckedkey(t, &k, &v);
+    }
+  }
+  if (i == size) {  /* moved all nodes? */
+    limbox(t)->c.oldnode = NULL;
+    freehash(L, &old);
+    ilyaC_acctsize(L, t);
+  }
+  else
+    limbox(t)->c.oldpos = i;
+}
+
+
+/*
+** Finish moving the nodes of an old hash part of table 't', if any.
+** Needed before anything that counts or reinserts the hash part.
+*/
+static void finishmove (ilya_State *L, Table *t) {
+  if (ismoving(t))
+    movenodes(L, t, twoto(limbox(t)->c.oldlsize));
+}
+
+
+/*
+** Grow the hash part of table 't' to 'size' nodes without moving its
+** nodes: the current part becomes the old part, to be moved by later
+** insertions.
+*/
+static void startmove (ilya_State *L, Table *t, unsigned size) {
+  Table newt;  /* to keep the new hash part */
+  setnodevector(L, &newt, size);
+  exchangehashpart(t, &newt);  /* 't' has the new hash ('newt' the old) */
+  limbox(t)->c.oldnode = newt.node;
+  limbox(t)->c.oldlsize = newt.lsizenode;
+  limbox(t)->c.oldpos = 0;
+  ilyaC_acctsize(L, t);
 }
 
 
@@ -710,6 +1176,7 @@ void ilyaH_resize (ilya_State *L, Table *t, unsigned newasize,
   Value *newarray;
   if (newasize > MAXASIZE)
     ilyaG_runerror(L, "table overflow");
+  finishmove(L, t);
   /* create new hash part with appropriate size into 'newt' */
   newt.flags = 0;
   setnodevector(L, &newt, nhsize);
@@ -729,12 +1196,15 @@ void ilyaH_resize (ilya_State *L, Table *t, unsigned newasize,
   exchangehashpart(t, &newt);  /* 't' has the new hash ('newt' has the old) */
   t->array = newarray;  /* set new array part */
   t->asize = newasize;
+  if (hascards(t) && newasize != oldasize)
+    ilyaC_dropcards(L, t);  /* cards do not match the new array */
   if (newarray != NULL)
     *lenhint(t) = newasize / 2u;  /* set an initial hint */
   clearNewSlice(t, oldasize, newasize);
   /* re-insert elements from old hash part into new parts */
   reinserthash(L, &newt, t);  /* 'newt' now has the old hash */
   freehash(L, &newt);  /* free old hash part */
+  ilyaC_acctsize(L, t);
 }
 
 
@@ -744,16 +1214,31 @@ void ilyaH_resizearray (ilya_State *L, Table *t, unsigned int nasize) {
 }
 
 
+/*
+** Can table 't' grow its hash part to 'size' nodes by moving its nodes
+** a few at a time? (Only large hash parts, and only in the chained
+** layout, do that.)
+*/
+#if !defined(ILYA_SWISSHASH)
+#define canmove(t,size)  \
+	((t)->lsizenode >= LIMFORMOVE && ilyaO_ceillog2(size) > (t)->lsizenode)
+#else
+#define canmove(t,size)	0
+#endif
+
+
 /*
 ** Rehash a table. First, count its keys. If there are array indices
 ** outside the array part, compute the new best size for that part.
-** Then, resize the table.
+** Then, resize the table. A large hash part that only grows starts
+** moving its nodes, instead of reinserting all of them now.
 */
 static void rehash (ilya_State *L, Table *t, const TValue *ek) {
   unsigned asize;  /* optimal size for array part */
   Counters ct;
   unsigned i;
   unsigned nsize;  /* size for the hash part */
+  finishmove(L, t);
   /* reset counts */
   for (i = 0; i <= MAXABITS; i++) ct.nums[i] = 0;
   ct.na = 0;
@@ -778,7 +1263,95 @@ static void rehash (ilya_State *L, Table *t, const TValue *ek) {
     nsize += nsize >> 2;
   }
   /* resize the table to new computed sizes */
+  if (asize == t->asize && canmove(t, nsize))
+    startmove(L, t, nsize);
+  else
+    ilyaH_resize(L, t, asize, nsize);
+}
+
+
+/*
+** Resize a table to the sizes its current keys need, as 'rehash' would
+** compute them but without extra room for deleted entries. Unlike
+** 'rehash', this may shrink the array part, giving back the memory of
+** tables emptied after holding many elements. Returns whether the
+** table changed.
+*/
+int ilyaH_shrink (ilya_State *L, Table *t) {
+  unsigned asize;
+  Counters ct;
+  unsigned i;
+  unsigned nsize;
+  int oldlsize;
+  int newlsize;
+  finishmove(L, t);
+  oldlsize = isdummy(t) ? -1 : t->lsizenode;
+  for (i = 0; i <= MAXABITS; i++) ct.nums[i] = 0;
+  ct.na = 0;
+  ct.deleted = 0;
+  ct.total = 0;
+  if (!isdummy(t))
+    numusehash(t, &ct);
+  numusearray(t, &ct);
+  asize = computesizes(&ct);
+  nsize = ct.total - ct.na;
+  newlsize = (nsize == 0) ? -1 : ilyaO_ceillog2(nsize);
+  if (asize == t->asize && newlsize == oldlsize)
+    return 0;  /* already at its best size */
   ilyaH_resize(L, t, asize, nsize);
+  return 1;
+}
+
+
+/*
+** Make the new table 'c' a copy of 't', with the same sizes, copying
+** each part as a block. The keys and their positions do not change,
+** so only 'lastfree' needs fixing. 'c' must be anchored and still
+** empty. All its parts are allocated before any value is copied: an
+** allocation can run an emergency collection, which in generational
+** mode makes 'c' old, and a young value already copied into it would
+** need a barrier. A collection during the allocations leaves 'c' and
+** all values of 't' white (incremental mode) or all old (generational
+** mode), and no collection runs while copying, so no barriers are
+** needed.
+*/
+void ilyaH_copy (ilya_State *L, Table *c, Table *t) {
+  unsigned asize = t->asize;
+  char *block = NULL;
+  ilya_assert(c->asize == 0 && isdummy(c));
+  finishmove(L, t);
+  if (asize > 0)
+    ilyaH_resize(L, c, asize, 0);
+  if (!isdummy(t))
+    block = ilyaM_newblock(L, sizehash(t));
+  if (asize > 0)
+    memcpy(c->array - asize, t->array - asize, concretesize(asize));
+  if (block != NULL) {
+    memcpy(block, cast_charp(t->node) - extrahash(t), sizehash(t));
+    c->node = cast(Node *, block + extrahash(t));
+    c->lsizenode = t->lsizenode;
+#if !defined(ILYA_SWISSHASH)
+    if (haslastfree(c))
+      getlastfree(c) = c->node + (getlastfree(t) - t->node);
+#endif
+  }
+  c->metatable = t->metatable;
+  invalidateTMcache(c);
+  ilyaC_acctsize(L, c);
+}
+
+
+/*
+** Freeze table 't': give it the sizes its keys need, as 'ilyaH_shrink'
+** does, and mark it so that any assignment to it raises an error.
+** Its parts never change after that, so lookups keep the chains that
+** the compact sizes gave them.
+*/
+void ilyaH_freeze (ilya_State *L, Table *t) {
+  if (!isfrozen(t)) {
+    ilyaH_shrink(L, t);
+    t->flags |= BITFROZEN;
+  }
 }
 
 /*
@@ -800,8 +1373,12 @@ Table *ilyaH_new (ilya_State *L) {
 
 lu_mem ilyaH_size (Table *t) {
   lu_mem sz = cast(lu_mem, sizeof(Table)) + concretesize(t->asize);
-  if (!isdummy(t))
+  if (!isdummy(t)) {
+    Table old;
     sz += sizehash(t);
+    if (ismoving(t))
+      sz += sizehash(oldpart(t, &old));
+  }
   return sz;
 }
 
@@ -810,12 +1387,27 @@ lu_mem ilyaH_size (Table *t) {
 ** Frees a table.
 */
 void ilyaH_free (ilya_State *L, Table *t) {
+  if (ismoving(t)) {  /* free the old hash part, too */
+    Table old;
+    freehash(L, oldpart(t, &old));
+  }
   freehash(L, t);
   resizearray(L, t, t->asize, 0);
   ilyaM_free(L, t);
 }
 
 
+#if !defined(ILYA_SWISSHASH)
+
+/*
+** Returns the 'lastfree' mark of a table, or NULL if it has none. Any
+** insertion that moves a node to a free position changes this mark.
+*/
+Node *ilyaH_lastfree (Table *t) {
+  return (!isdummy(t) && haslastfree(t)) ? getlastfree(t) : NULL;
+}
+
+
 static Node *getfreepos (Table *t) {
   if (haslastfree(t)) {  /* does it have 'lastfree' information? */
     /* look for a spot before 'lastfree', updating 'lastfree' */
@@ -884,6 +1476,8 @@ static int insertkey (Table *t, const TValue *key, TValue *value) {
   return 1;
 }
 
+#endif
+
 
 /*
 ** Insert a key in a table where there is space for that key, the
@@ -909,13 +1503,17 @@ static void ilyaH_newkey (ilya_State *L, Table *t, const TValue *key,
       rehash(L, t, key);  /* grow table */
       newcheckedkey(t, key, value);  /* insert key in grown table */
     }
-    ilyaC_barrierback(L, obj2gco(t), key);
+    if (l_unlikely(ismoving(t)))
+      movenodes(L, t, MOVESTEP);  /* keep moving an old hash part */
+    ilyaC_barriertable(L, t, key, key);
     /* for debugging only: any new key may force an emergency collection */
     condchangemem(L, (void)0, (void)0, 1);
   }
 }
 
 
+#if !defined(ILYA_SWISSHASH)
+
 static const TValue *getintfromhash (Table *t, ilya_Integer key) {
   Node *n = hashint(t, key);
   ilya_assert(!ikeyinarray(t, key));
@@ -928,9 +1526,16 @@ static const TValue *getintfromhash (Table *t, ilya_Integer key) {
       n += nx;
     }
   }
+  if (l_unlikely(ismoving(t))) {
+    TValue k;
+    setivalue(&k, key);
+    return getold(t, &k, 0);
+  }
   return &absentkey;
 }
 
+#endif
+
 
 static int hashkeyisempty (Table *t, ilya_Unsigned key) {
   const TValue *val = getintfromhash(t, l_castU2S(key));
@@ -959,6 +1564,8 @@ lu_byte ilyaH_getint (Table *t, ilya_Integer key, TValue *res) {
 }
 
 
+#if !defined(ILYA_SWISSHASH)
+
 /*
 ** search fn for short strings
 */
@@ -970,13 +1577,21 @@ const TValue *ilyaH_Hgetshortstr (Table *t, TString *key) {
       return gval(n);  /* that's it */
     else {
       int nx = gnext(n);
-      if (nx == 0)
+      if (nx == 0) {  /* not in the nodes? */
+        if (l_unlikely(ismoving(t))) {
+          TValue k;
+          setsvalue(cast(ilya_State *, NULL), &k, key);
+          return getold(t, &k, 0);
+        }
         return &absentkey;  /* not found */
+      }
       n += nx;
     }
   }
 }
 
+#endif
+
 
 lu_byte ilyaH_getshortstr (Table *t, TString *key, TValue *res) {
   return finishnodeget(ilyaH_Hgetshortstr(t, key), res);
@@ -1045,7 +1660,7 @@ static int retpsetcode (Table *t, const TValue *slot) {
 
 
 static int finishnodeset (Table *t, const TValue *slot, TValue *val) {
-  if (!ttisnil(slot)) {
+  if (!ttisnil(slot) && !isfrozen(t)) {
     setobj(((ilya_State*)NULL), cast(TValue*, slot), val);
     return HOK;  /* success */
   }
@@ -1087,7 +1702,9 @@ static int psetint (Table *t, ilya_Integer key, TValue *val) {
 
 int ilyaH_psetshortstr (Table *t, TString *key, TValue *val) {
   const TValue *slot = ilyaH_Hgetshortstr(t, key);
-  if (!ttisnil(slot)) {  /* key already has a value? (all too common) */
+  if (l_unlikely(isfrozen(t)))
+    return HNOTFOUND;  /* 'ilyaH_finishset' will raise the error */
+  else if (!ttisnil(slot)) {  /* key already has a value? (all too common) */
     setobj(((ilya_State*)NULL), cast(TValue*, slot), val);  /* update it */
     return HOK;  /* done */
   }
@@ -1095,7 +1712,8 @@ int ilyaH_psetshortstr (Table *t, TString *key, TValue *val) {
     if (ttisnil(val))  /* new value is nil? */
       return HOK;  /* done (value is already nil/absent) */
     if (isabstkey(slot) &&  /* key is absent? */
-       !(isblack(t) && iswhite(key))) {  /* and don't need barrier? */
+       !(isblack(t) && iswhite(key)) &&  /* and don't need barrier? */
+       !ismoving(t)) {  /* and has no nodes to move? */
       TValue tk;  /* key as a TValue */
       setsvalue(cast(ilya_State *, NULL), &tk, key);
       if (insertkey(t, &tk, val)) {  /* insert key, if there is space */
@@ -1144,6 +1762,8 @@ int ilyaH_pset (Table *t, const TValue *key, TValue *val) {
 void ilyaH_finishset (ilya_State *L, Table *t, const TValue *key,
                                     TValue *value, int hres) {
   ilya_assert(hres != HOK);
+  if (l_unlikely(isfrozen(t)))
+    ilyaG_runerror(L, "attempt to modify a frozen table");
   if (hres == HNOTFOUND) {
     TValue aux;
     if (l_unlikely(ttisnil(key)))
@@ -1187,6 +1807,8 @@ void ilyaH_set (ilya_State *L, Table *t, const TValue *key, TValue *value) {
 */
 void ilyaH_setint (ilya_State *L, Table *t, ilya_Integer key, TValue *value) {
   unsigned ik = ikeyinarray(t, key);
+  if (l_unlikely(isfrozen(t)))
+    ilyaG_runerror(L, "attempt to modify a frozen table");
   if (ik > 0)
     obj2arr(t, ik - 1, value);
   else {
@@ -1200,6 +1822,21 @@ void ilyaH_setint (ilya_State *L, Table *t, ilya_Integer key, TValue *value) {
 }
 
 
+/*
+** Binary search in the hash part of 't' for a border in [i, j), given
+** that 't[i]' is present and 't[j]' is absent.
+*/
+static ilya_Unsigned hash_binsearch (Table *t, ilya_Unsigned i,
+                                               ilya_Unsigned j) {
+  while (j - i > 1u) {  /* do a binary search between them */
+    ilya_Unsigned m = (i + j) / 2;
+    if (hashkeyisempty(t, m)) j = m;
+    else i = m;
+  }
+  return i;
+}
+
+
 /*
 ** Try to find a boundary in the hash part of table 't'. From the
 ** caller, we know that 'j' is zero or present and that 'j + 1' is
@@ -1228,13 +1865,40 @@ static ilya_Unsigned hash_search (Table *t, ilya_Unsigned j) {
         return j;  /* well, max integer is a boundary... */
     }
   } while (!hashkeyisempty(t, j));  /* repeat until an absent t[j] */
-  /* i < j  &&  t[i] present  &&  t[j] absent */
-  while (j - i > 1u) {  /* do a binary search between them */
-    ilya_Unsigned m = (i + j) / 2;
-    if (hashkeyisempty(t, m)) j = m;
-    else i = m;
+  return hash_binsearch(t, i, j);
+}
+
+
+/*
+** Find a border in the hash part of a table with a Limbox, knowing that
+** 't[asize + 1]' is present. As in the array part, first try the
+** vicinity of the border found by the previous call, kept in the
+** Limbox; otherwise, search from the closest known present index.
+*/
+static ilya_Unsigned hashborder (Table *t, unsigned asize) {
+  const unsigned maxvicinity = 4;
+  ilya_Unsigned hint = limbox(t)->c.border;
+  unsigned i;
+  if (hint <= asize)  /* no hint? */
+    hint = hash_search(t, asize);
+  else if (!hashkeyisempty(t, hint)) {  /* t[hint] present? */
+    for (i = 0; i < maxvicinity; i++) {
+      if (hint == l_castS2U(ILYA_MAXINTEGER) || hashkeyisempty(t, hint + 1))
+        break;  /* 'hint' is a border */
+      hint++;
+    }
+    if (i == maxvicinity)  /* not found in the vicinity? */
+      hint = hash_search(t, hint);
   }
-  return i;
+  else {  /* t[hint] absent; there is a border in [asize + 1, hint) */
+    for (i = 0; i < maxvicinity && hint > asize + 1u; i++) {
+      if (!hashkeyisempty(t, --hint))
+        break;  /* 'hint' is a border */
+    }
+    if (hashkeyisempty(t, hint))  /* not found in the vicinity? */
+      hint = hash_binsearch(t, asize + 1u, hint);
+  }
+  return limbox(t)->c.border = hint;
 }
 
 
@@ -1308,12 +1972,246 @@ ilya_Unsigned ilyaH_getn (Table *t) {
   ilya_assert(asize == 0 || !arraykeyisempty(t, asize));
   if (isdummy(t) || hashkeyisempty(t, asize + 1))
     return asize;  /* 'asize + 1' is empty */
+  else if (haslimbox(t))  /* can keep a hint for the hash part? */
+    return hashborder(t, asize);
   else  /* 'asize + 1' is also non empty */
     return hash_search(t, asize);
 }
 
 
 
+/*
+** {==============================================================
+** Sorting numbers
+** ===============================================================
+*/
+
+/*
+** The array part already keeps its values apart from their tags, so
+** an array of integers (or of floats) is a plain vector of C numbers.
+** 'table.sort' with no order function can sort such a vector in place,
+** with no API calls for each comparison and each move. The vector is
+** stored backwards (see 'getArrVal'), so the values are sorted in
+** decreasing order of addresses.
+*/
+
+/* whether 'a' must come before 'b' in memory */
+#define before(isint,a,b)    ((isint) ? (b).i < (a).i : ilyai_numlt((b).n, (a).n))
+
+#define swapval(a,b)	{ Value temp_ = (a); (a) = (b); (b) = temp_; }
+
+/* intervals up to this size are sorted by insertion */
+#define RAWSORTMIN	16
+
+
+static void siftdown (Value *v, int i, int n, int isint) {
+  for (;;) {
+    int c = 2 * i + 1;
+    if (c >= n)
+      break;
+    if (c + 1 < n && before(isint, v[c], v[c + 1]))
+      c++;
+    if (!before(isint, v[i], v[c]))
+      break;
+    swapval(v[i], v[c]);
+    i = c;
+  }
+}
+
+
+static void rawheapsort (Value *v, int n, int isint) {
+  int i;
+  for (i = n / 2 - 1; i >= 0; i--)
+    siftdown(v, i, n, isint);
+  while (--n > 0) {
+    swapval(v[0], v[n]);
+    siftdown(v, 0, n, isint);
+  }
+}
+
+
+/*
+** Quicksort with a median-of-three pivot, switching to heapsort
+** after 'depth' bad partitions, so that no input is quadratic.
+*/
+static void rawsort (Value *v, int n, int isint, int depth) {
+  int i, j;
+  while (n > RAWSORTMIN) {
+    Value p;
+    int m = n / 2;
+    if (depth-- == 0) {
+      rawheapsort(v, n, isint);
+      return;
+    }
+    if (before(isint, v[m], v[0])) swapval(v[m], v[0]);
+    if (before(isint, v[n - 1], v[m])) {
+      swapval(v[n - 1], v[m]);
+      if (before(isint, v[m], v[0])) swapval(v[m], v[0]);
+    }
+    p = v[m];
+    i = -1; j = n;
+    for (;;) {  /* Hoare partition */
+      do i++; while (before(isint, v[i], p));
+      do j--; while (before(isint, p, v[j]));
+      if (i >= j) break;
+      swapval(v[i], v[j]);
+    }
+    j++;  /* v[0..j-1] <= p <= v[j..n-1] */
+    if (j < n - j) {  /* recurse into the smaller part */
+      rawsort(v, j, isint, depth);
+      v += j; n -= j;
+    }
+    else {
+      rawsort(v + j, n - j, isint, depth);
+      n = j;
+    }
+  }
+  for (i = 1; i < n; i++) {  /* insertion sort */
+    Value x = v[i];
+    for (j = i; j > 0 && before(isint, x, v[j - 1]); j--)
+      v[j] = v[j - 1];
+    v[j] = x;
+  }
+}
+
+
+/*
+** If t[1..n] are all in the array part and all integers, or all floats
+** other than NaN, sort them and return true. Otherwise, return false
+** without touching the table.
+*/
+int ilyaH_sortnumbers (Table *t, unsigned n) {
+  lu_byte tag;
+  unsigned i;
+  if (n == 0 || n > t->asize || n > cast_uint(INT_MAX) || isfrozen(t))
+    return 0;
+  tag = *getArrTag(t, 0);
+  if (tag != ILYA_VNUMINT && tag != ILYA_VNUMFLT)
+    return 0;
+  for (i = 0; i < n; i++) {
+    if (*getArrTag(t, i) != tag ||
+        (tag == ILYA_VNUMFLT && ilyai_numisnan(getArrVal(t, i)->n)))
+      return 0;
+  }
+  rawsort(getArrVal(t, n - 1), cast_int(n), tag == ILYA_VNUMINT,
+          2 * ilyaO_ceillog2(n));
+  return 1;
+}
+
+
+/*
+** Kinds of values that 'ilyaH_siftheap' compares: integers, floats
+** other than NaN, and strings (short or long). Each kind is the tag of
+** its values, or ILYA_TSTRING for strings.
+*/
+l_sinline int samekind (Table *t, unsigned j, int kind) {
+  lu_byte tag = *getArrTag(t, j - 1);  /* 'j' is 1-based */
+  if (kind == ILYA_TSTRING)
+    return novariant(tag) == ILYA_TSTRING;
+  else
+    return tag == kind &&
+           (kind == ILYA_VNUMINT || !ilyai_numisnan(getArrVal(t, j - 1)->n));
+}
+
+
+/* whether 'a' is less than 'b', both values of kind 'kind' */
+l_sinline int heapless (int kind, const TValue *a, const TValue *b) {
+  if (kind == ILYA_VNUMINT)
+    return ivalue(a) < ivalue(b);
+  else if (kind == ILYA_VNUMFLT)
+    return ilyai_numlt(fltvalue(a), fltvalue(b));
+  else
+    return ilyaV_strcmp(tsvalue(a), tsvalue(b)) < 0;
+}
+
+
+/*
+** Store 'v' in t[i] (1-based). A string may come from a part of the
+** table that the collector has not traversed yet (or from a clean
+** card), so it needs a barrier like any other write.
+*/
+l_sinline void heapstore (ilya_State *L, Table *t, unsigned i,
+                                         const TValue *v, int kind) {
+  obj2arr(t, i - 1, v);
+  if (kind == ILYA_TSTRING) {
+    TValue k;
+    setivalue(&k, cast(ilya_Integer, i));
+    ilyaC_barriertable(L, t, &k, v);
+  }
+}
+
+
+/*
+** Move 'v', the value t[i] of kind 'kind', as 'ilyaH_siftheap' does.
+** Each call has a constant 'kind', so that the compiler can specialize
+** the loops for it.
+*/
+l_sinline unsigned siftkind (ilya_State *L, Table *t, unsigned n,
+                             unsigned i, int up, const TValue *v,
+                             int kind) {
+  TValue x;
+  if (up) {
+    while (i > 1 && samekind(t, i / 2, kind)) {
+      arr2obj(t, i / 2 - 1, &x);  /* parent */
+      if (!heapless(kind, v, &x))
+        break;
+      heapstore(L, t, i, &x, kind);  /* move parent down */
+      i /= 2;
+    }
+  }
+  else {
+    unsigned c;
+    while ((c = 2 * i) <= n && samekind(t, c, kind)) {
+      arr2obj(t, c - 1, &x);  /* left child */
+      if (c < n) {
+        TValue y;
+        if (!samekind(t, c + 1, kind))
+          break;
+        arr2obj(t, c, &y);  /* right child */
+        if (heapless(kind, &y, &x)) {  /* right child is the least one? */
+          x = y;
+          c++;
+        }
+      }
+      if (!heapless(kind, &x, v))
+        break;
+      heapstore(L, t, i, &x, kind);  /* move child up */
+      i = c;
+    }
+  }
+  heapstore(L, t, i, v, kind);
+  return i;
+}
+
+
+/*
+** In the heap 't[1 .. n]', with its least element at 1, move 't[i]'
+** up (if 'up') or down, as long as the elements it meets are in the
+** array part and are values of its kind (integers, floats other than
+** NaN, or strings), which compare without metamethods. Returns the
+** new position of that element, where the heap may need more work if
+** it stopped at other values.
+*/
+unsigned ilyaH_siftheap (ilya_State *L, Table *t, unsigned n, unsigned i,
+                                                  int up) {
+  TValue v;
+  if (n > t->asize || isfrozen(t))
+    return i;
+  arr2obj(t, i - 1, &v);
+  if (ttisinteger(&v))
+    return siftkind(L, t, n, i, up, &v, ILYA_VNUMINT);
+  else if (ttisfloat(&v) && !ilyai_numisnan(fltvalue(&v)))
+    return siftkind(L, t, n, i, up, &v, ILYA_VNUMFLT);
+  else if (ttisstring(&v))
+    return siftkind(L, t, n, i, up, &v, ILYA_TSTRING);
+  else
+    return i;
+}
+
+/* }============================================================= */
+
+
+
 #if defined(ILYA_DEBUG)
 
 /* export this fn for the test library */
@@ -24,16 +24,28 @@
 
 
 /*
-** Bit BITDUMMY set in 'flags' means the table is using the dummy node
-** for its hash part.
+** A table with an empty hash part uses the common dummy node (see
+** ltable.c). (In the one-file build, 'ltable.c' comes before all
+** other users of this declaration.)
 */
+ILYAI_DDEC(const Node *const ilyaH_dummynode;)
+#define isdummy(t)		((t)->node == ilyaH_dummynode)
 
-#define BITDUMMY		(1 << 6)
-#define NOTBITDUMMY		cast_byte(~BITDUMMY)
-#define isdummy(t)		((t)->flags & BITDUMMY)
 
-#define setnodummy(t)		((t)->flags &= NOTBITDUMMY)
-#define setdummy(t)		((t)->flags |= BITDUMMY)
+/*
+** Bit BITFROZEN set in 'flags' means the table is frozen: assignments
+** to it raise errors (see 'ilyaH_freeze').
+*/
+#define BITFROZEN		(1 << 6)
+#define isfrozen(t)		((t)->flags & BITFROZEN)
+
+
+/*
+** Bit BITCARDS set in 'flags' means the collector keeps a card set
+** for the table (see 'lgc.c').
+*/
+#define BITCARDS		(1 << 7)
+#define hascards(t)		((t)->flags & BITCARDS)
 
 
 
@@ -58,7 +70,8 @@
   { Table *h = t; ilya_Unsigned u = l_castS2U(k) - 1u; \
     if ((u < h->asize)) { \
       lu_byte *tag = getArrTag(h, u); \
-      if (checknoTM(h->metatable, TM_NEWINDEX) || !tagisempty(*tag)) \
+      if (!isfrozen(h) && \
+          (checknoTM(h->metatable, TM_NEWINDEX) || !tagisempty(*tag))) \
         { fval2arr(h, u, tag, val); hres = HOK; } \
       else hres = ~cast_int(u); } \
     else { hres = ilyaH_psetint(h, k, val); }}
@@ -170,10 +183,18 @@ ILYAI_FUNC Table *ilyaH_new (ilya_State *L);
 ILYAI_FUNC void ilyaH_resize (ilya_State *L, Table *t, unsigned nasize,
                                                     unsigned nhsize);
 ILYAI_FUNC void ilyaH_resizearray (ilya_State *L, Table *t, unsigned nasize);
+ILYAI_FUNC int ilyaH_shrink (ilya_State *L, Table *t);
+ILYAI_FUNC void ilyaH_copy (ilya_State *L, Table *c, Table *t);
+ILYAI_FUNC void ilyaH_freeze (ilya_State *L, Table *t);
 ILYAI_FUNC lu_mem ilyaH_size (Table *t);
 ILYAI_FUNC void ilyaH_free (ilya_State *L, Table *t);
 ILYAI_FUNC int ilyaH_next (ilya_State *L, Table *t, StkId key);
+ILYAI_FUNC Node *ilyaH_lastfree (Table *t);
+ILYAI_FUNC Node *ilyaH_oldnodes (const Table *t, unsigned *size);
 ILYAI_FUNC ilya_Unsigned ilyaH_getn (Table *t);
+ILYAI_FUNC int ilyaH_sortnumbers (Table *t, unsigned n);
+ILYAI_FUNC unsigned ilyaH_siftheap (ilya_State *L, Table *t, unsigned n,
+                                    unsigned i, int up);
 
 
 #if defined(ILYA_DEBUG)
@@ -69,6 +69,79 @@ static int tcreate (ilya_State *L) {
 }
 
 
+static int tcompact (ilya_State *L) {
+  ilyaL_checktype(L, 1, ILYA_TTABLE);
+  ilya_settop(L, 1);
+  ilya_compacttable(L, 1);
+  return 1;
+}
+
+
+/*
+** Deep clone: 'memo' (index 3) maps each table already cloned to its
+** clone, so that shared tables and cycles are kept; 'pending' (index 4)
+** lists the clones whose fields still refer to the original tables.
+*/
+static int tclone (ilya_State *L) {
+  ilya_Integer n = 1;  /* number of entries in 'pending' */
+  ilyaL_checktype(L, 1, ILYA_TTABLE);
+  ilya_settop(L, 2);
+  ilya_clonetable(L, 1);
+  if (!ilya_toboolean(L, 2))
+    return 1;
+  ilya_replace(L, 2);  /* result */
+  ilya_newtable(L);  /* memo */
+  ilya_pushvalue(L, 1);
+  ilya_pushvalue(L, 2);
+  ilya_rawset(L, 3);  /* memo[original] = clone */
+  ilya_newtable(L);  /* pending */
+  ilya_pushvalue(L, 2);
+  ilya_rawseti(L, 4, 1);
+  while (n > 0) {
+    ilya_rawgeti(L, 4, n);  /* clone to be fixed (index 5) */
+    ilya_pushnil(L);
+    ilya_rawseti(L, 4, n--);
+    ilya_pushnil(L);  /* first key */
+    while (ilya_next(L, 5)) {  /* stack: key, value */
+      if (ilya_type(L, -1) == ILYA_TTABLE) {
+        ilya_pushvalue(L, -1);
+        if (ilya_rawget(L, 3) == ILYA_TNIL) {  /* not cloned yet? */
+          ilya_pop(L, 1);
+          ilya_clonetable(L, -1);
+          ilya_pushvalue(L, -2);
+          ilya_pushvalue(L, -2);
+          ilya_rawset(L, 3);  /* memo[value] = clone */
+          ilya_pushvalue(L, -1);
+          ilya_rawseti(L, 4, ++n);  /* its fields need fixing too */
+        }
+        ilya_pushvalue(L, -3);  /* key */
+        ilya_insert(L, -2);
+        ilya_rawset(L, 5);  /* clone[key] = clone of value */
+      }
+      ilya_pop(L, 1);  /* remove value; keep key for next iteration */
+    }
+    ilya_pop(L, 1);  /* remove fixed clone */
+  }
+  ilya_settop(L, 2);
+  return 1;
+}
+
+
+static int tfreeze (ilya_State *L) {
+  ilyaL_checktype(L, 1, ILYA_TTABLE);
+  ilya_settop(L, 1);
+  ilya_freezetable(L, 1);
+  return 1;
+}
+
+
+static int tisfrozen (ilya_State *L) {
+  ilyaL_checktype(L, 1, ILYA_TTABLE);
+  ilya_pushboolean(L, ilya_isfrozen(L, 1));
+  return 1;
+}
+
+
 static int tinsert (ilya_State *L) {
   ilya_Integer pos;  /* where to insert new element */
   ilya_Integer e = aux_getn(L, 1, TAB_RW);
@@ -398,18 +471,374 @@ static int sort (ilya_State *L) {
     if (!ilya_isnoneornil(L, 2))  /* is there a 2nd argument? */
       ilyaL_checktype(L, 2, ILYA_TFUNCTION);  /* must be a fn */
     ilya_settop(L, 2);  /* make sure there are two arguments */
-    auxsort(L, 1, (IdxT)n, 0);
+    if (!(ilya_isnil(L, 2) && ilya_type(L, 1) == ILYA_TTABLE &&
+          ilya_sortnumbers(L, 1, n)))  /* not an array of numbers? */
+      auxsort(L, 1, (IdxT)n, 0);
+  }
+  return 0;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Binary heaps
+** Heaps are arrays where each 't[i]' is not greater than 't[2*i]' and
+** 't[2*i + 1]', so that 't[1]' is the least element. They use the
+** order of 'sort' (with its optional fn at stack index 2), and
+** move each element only once per level, keeping the moving value in
+** the stack. With no order fn, 'ilya_siftheap' first moves an
+** element past the numbers or strings that the table keeps in its
+** array part; the generic code only goes on from where it stopped.
+** =======================================================
+*/
+
+
+/* can 'ilya_siftheap' handle the heap? */
+#define rawheap(L)	(ilya_isnil(L, 2) && ilya_type(L, 1) == ILYA_TTABLE)
+
+
+/*
+** Move the value at the top of the stack up from position 'i' of the
+** heap, moving down the parents greater than it, and store it.
+*/
+static void heapsiftup (ilya_State *L, IdxT i) {
+  while (i > 1) {
+    IdxT p = i / 2;
+    geti(L, 1, p);  /* parent */
+    if (!sort_comp(L, -2, -1)) {  /* not less than its parent? */
+      ilya_pop(L, 1);
+      break;
+    }
+    seti(L, 1, i);  /* a[i] = parent */
+    i = p;
+  }
+  seti(L, 1, i);
+}
+
+
+/*
+** Move the value at the top of the stack down from position 'i' of
+** the heap 'a[1 .. n]', moving up its least children while they are
+** less than it, and store it.
+*/
+static void heapsiftdown (ilya_State *L, IdxT i, IdxT n) {
+  IdxT c;
+  while ((c = 2 * i) <= n) {
+    geti(L, 1, c);  /* left child */
+    if (c < n) {
+      geti(L, 1, c + 1);  /* right child */
+      if (sort_comp(L, -1, -2)) {  /* right child is the least one? */
+        ilya_remove(L, -2);
+        c++;
+      }
+      else
+        ilya_pop(L, 1);
+    }
+    if (!sort_comp(L, -1, -2)) {  /* least child not less than value? */
+      ilya_pop(L, 1);
+      break;
+    }
+    seti(L, 1, i);  /* a[i] = least child */
+    i = c;
+  }
+  seti(L, 1, i);
+}
+
+
+/* get the size of the heap at index 1, checking its order fn */
+static IdxT heapsize (ilya_State *L, int comparg, int w) {
+  ilya_Integer n = aux_getn(L, 1, w);
+  ilyaL_argcheck(L, n < INT_MAX, 1, "array too big");
+  if (!ilya_isnoneornil(L, comparg))  /* is there an order fn? */
+    ilyaL_checktype(L, comparg, ILYA_TFUNCTION);  /* must be a fn */
+  return (IdxT)n;
+}
+
+
+static int heapify (ilya_State *L) {
+  IdxT n = heapsize(L, 2, TAB_RW);
+  IdxT i;
+  ilya_settop(L, 2);  /* make sure there are two arguments */
+  for (i = n / 2; i >= 1; i--) {
+    IdxT p = rawheap(L) ? (IdxT)ilya_siftheap(L, 1, n, i, 0) : i;
+    geti(L, 1, p);
+    heapsiftdown(L, p, n);
+  }
+  return 0;
+}
+
+
+static int heappush (ilya_State *L) {
+  IdxT n = heapsize(L, 3, TAB_RW);
+  IdxT i = n + 1;
+  ilyaL_checkany(L, 2);
+  ilya_settop(L, 3);
+  ilya_rotate(L, 2, 1);  /* order fn goes to index 2; value to the top */
+  if (rawheap(L)) {
+    ilya_pushvalue(L, -1);
+    seti(L, 1, i);  /* a[n + 1] = value */
+    i = (IdxT)ilya_siftheap(L, 1, i, i, 1);
   }
+  heapsiftup(L, i);
   return 0;
 }
 
+
+static int heappop (ilya_State *L) {
+  IdxT n = heapsize(L, 2, TAB_RW);
+  ilya_settop(L, 2);
+  geti(L, 1, 1);  /* result = a[1] */
+  if (n > 0) {
+    geti(L, 1, n);  /* last element */
+    ilya_pushnil(L);
+    seti(L, 1, n);  /* remove it */
+    if (n > 1) {  /* put it in the place of the first */
+      IdxT i = 1;
+      if (rawheap(L)) {
+        ilya_pushvalue(L, -1);
+        seti(L, 1, 1);  /* a[1] = last element */
+        i = (IdxT)ilya_siftheap(L, 1, n - 1, 1, 0);
+      }
+      heapsiftdown(L, i, n - 1);
+    }
+    else
+      ilya_pop(L, 1);
+  }
+  return 1;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Deques
+** =======================================================
+*/
+
+#define DEQUEHANDLE	"deque"
+
+/*
+** A deque is a userdata whose user value is a ring: a table with
+** 'size' slots in its array part, where the 'n' elements start at
+** slot 'first + 1' and wrap around. The ring doubles when full, so
+** all operations at either end are O(1).
+*/
+typedef struct Deque {
+  ilya_Integer first;  /* slot before the first element (0-based) */
+  ilya_Integer n;  /* number of elements */
+  ilya_Integer size;  /* number of slots in the ring */
+} Deque;
+
+
+#define checkdeque(L)	((Deque *)ilyaL_checkudata(L, 1, DEQUEHANDLE))
+
+
+/* slot in the ring of element 'i' (1-based) of deque 'q' */
+#define ringslot(q,i)	(((q)->first + (i) - 1) % (q)->size + 1)
+
+
+/*
+** Make sure the ring of deque 'q' (at the top of the stack) has room
+** for one more element, replacing it by a larger one if needed.
+*/
+static void growring (ilya_State *L, Deque *q) {
+  if (q->n == q->size) {  /* ring is full? */
+    ilya_Integer nsize = (q->size < 4) ? 4 : q->size * 2;
+    ilya_Integer i;
+    if (l_unlikely(nsize >= INT_MAX))
+      ilyaL_error(L, "deque overflow");
+    ilya_createtable(L, cast_int(nsize), 0);
+    for (i = 1; i <= q->n; i++) {  /* copy elements in order */
+      ilya_rawgeti(L, -2, ringslot(q, i));
+      ilya_rawseti(L, -2, i);
+    }
+    ilya_pushvalue(L, -1);
+    ilya_setiuservalue(L, 1, 1);  /* deque gets the new ring */
+    ilya_replace(L, -2);  /* new ring replaces the old one in the stack */
+    q->first = 0;
+    q->size = nsize;
+  }
+}
+
+
+static void checkvalue (ilya_State *L, int arg) {
+  ilyaL_checkany(L, arg);
+  ilyaL_argcheck(L, !ilya_isnil(L, arg), arg, "deques cannot hold nil");
+}
+
+
+static int dq_pushfirst (ilya_State *L) {
+  Deque *q = checkdeque(L);
+  checkvalue(L, 2);
+  ilya_settop(L, 2);
+  ilya_getiuservalue(L, 1, 1);  /* ring */
+  growring(L, q);
+  q->first = (q->first + q->size - 1) % q->size;
+  ilya_pushvalue(L, 2);
+  ilya_rawseti(L, 3, q->first + 1);
+  q->n++;
+  return 0;
+}
+
+
+static int dq_pushlast (ilya_State *L) {
+  Deque *q = checkdeque(L);
+  checkvalue(L, 2);
+  ilya_settop(L, 2);
+  ilya_getiuservalue(L, 1, 1);  /* ring */
+  growring(L, q);
+  ilya_pushvalue(L, 2);
+  ilya_rawseti(L, 3, ringslot(q, q->n + 1));
+  q->n++;
+  return 0;
+}
+
+
+/*
+** Remove element 'i' (the first or the last one) from deque 'q' and
+** push it. Pushes nil and returns 0 if the deque is empty.
+*/
+static int popelem (ilya_State *L, Deque *q, ilya_Integer i) {
+  ilya_Integer slot;
+  if (q->n == 0) {  /* empty deque? */
+    ilya_pushnil(L);
+    return 0;
+  }
+  slot = ringslot(q, i);
+  ilya_getiuservalue(L, 1, 1);  /* ring */
+  ilya_rawgeti(L, -1, slot);  /* result */
+  ilya_pushnil(L);
+  ilya_rawseti(L, -3, slot);  /* clear its slot (for the GC) */
+  q->n--;
+  return 1;
+}
+
+
+static int dq_popfirst (ilya_State *L) {
+  Deque *q = checkdeque(L);
+  if (popelem(L, q, 1))
+    q->first = (q->first + 1) % q->size;
+  return 1;
+}
+
+
+static int dq_poplast (ilya_State *L) {
+  Deque *q = checkdeque(L);
+  popelem(L, q, q->n);
+  return 1;
+}
+
+
+/*
+** Integer keys index the elements, from 1 (the first one) to the
+** length of the deque; other keys index the methods, which are in
+** the upvalue.
+*/
+static int dq_index (ilya_State *L) {
+  Deque *q = checkdeque(L);
+  int isint;
+  ilya_Integer i = ilya_tointegerx(L, 2, &isint);
+  if (!isint) {
+    ilya_settop(L, 2);
+    ilya_rawget(L, ilya_upvalueindex(1));  /* method */
+  }
+  else if (l_castS2U(i) - 1u < l_castS2U(q->n)) {  /* 1 <= i <= n? */
+    ilya_getiuservalue(L, 1, 1);  /* ring */
+    ilya_rawgeti(L, -1, ringslot(q, i));
+  }
+  else
+    ilya_pushnil(L);
+  return 1;
+}
+
+
+static int dq_newindex (ilya_State *L) {
+  Deque *q = checkdeque(L);
+  ilya_Integer i = ilyaL_checkinteger(L, 2);
+  ilyaL_argcheck(L, l_castS2U(i) - 1u < l_castS2U(q->n), 2,
+                    "index out of range");
+  checkvalue(L, 3);
+  ilya_settop(L, 3);
+  ilya_getiuservalue(L, 1, 1);  /* ring */
+  ilya_pushvalue(L, 3);
+  ilya_rawseti(L, 4, ringslot(q, i));
+  return 0;
+}
+
+
+static int dq_len (ilya_State *L) {
+  ilya_pushinteger(L, checkdeque(L)->n);
+  return 1;
+}
+
+
+static int tdeque (ilya_State *L) {
+  int n = ilya_gettop(L);  /* number of initial elements */
+  int i;
+  Deque *q;
+  for (i = 1; i <= n; i++)
+    ilyaL_argcheck(L, !ilya_isnil(L, i), i, "deques cannot hold nil");
+  q = (Deque *)ilya_newuserdatauv(L, sizeof(Deque), 1);
+  q->first = q->n = q->size = 0;
+  ilyaL_setmetatable(L, DEQUEHANDLE);
+  ilya_createtable(L, n, 0);  /* ring */
+  for (i = 1; i <= n; i++) {
+    ilya_pushvalue(L, i);
+    ilya_rawseti(L, -2, i);
+  }
+  ilya_setiuservalue(L, -2, 1);
+  q->n = q->size = n;
+  return 1;
+}
+
+
+static const ilyaL_Reg dq_meth[] = {
+  {"pushfirst", dq_pushfirst},
+  {"pushlast", dq_pushlast},
+  {"popfirst", dq_popfirst},
+  {"poplast", dq_poplast},
+  {NULL, NULL}
+};
+
+
+static const ilyaL_Reg dq_metameth[] = {
+  {"__index", NULL},  /* placeholder */
+  {"__newindex", dq_newindex},
+  {"__len", dq_len},
+  {NULL, NULL}
+};
+
+
+static void createdequemeta (ilya_State *L) {
+  ilyaL_newmetatable(L, DEQUEHANDLE);  /* metatable for deques */
+  ilyaL_setfuncs(L, dq_metameth, 0);  /* add metamethods to it */
+  ilyaL_newlibtable(L, dq_meth);  /* create method table */
+  ilyaL_setfuncs(L, dq_meth, 0);  /* add deque methods to it */
+  ilya_pushcclosure(L, dq_index, 1);  /* method table is an upvalue */
+  ilya_setfield(L, -2, "__index");
+  ilya_pop(L, 1);  /* pop metatable */
+}
+
 /* }====================================================== */
 
 
 static const ilyaL_Reg tab_funcs[] = {
+  {"clone", tclone},
+  {"compact", tcompact},
   {"concat", tconcat},
   {"create", tcreate},
+  {"deque", tdeque},
+  {"freeze", tfreeze},
+  {"heapify", heapify},
+  {"heappop", heappop},
+  {"heappush", heappush},
   {"insert", tinsert},
+  {"isfrozen", tisfrozen},
   {"pack", tpack},
   {"unpack", tunpack},
   {"remove", tremove},
@@ -420,6 +849,7 @@ static const ilyaL_Reg tab_funcs[] = {
 
 
 ILYAMOD_API int ilyaopen_table (ilya_State *L) {
+  createdequemeta(L);
   ilyaL_newlib(L, tab_funcs);
   return 1;
 }
@@ -298,8 +298,9 @@ static int testobjref1 (global_State *g, GCObject *f, GCObject *t) {
   if (isdead(g,t)) return 0;
   if (issweepphase(g))
     return 1;  /* no invariants */
-  else if (g->gckind != KGC_GENMINOR)
-    return !(isblack(f) && iswhite(t));  /* basic incremental invariant */
+  else if (g->gckind != KGC_GENMINOR)  /* basic incremental invariant */
+    return !(isblack(f) && iswhite(t)) ||
+           (f->tt == ILYA_VTABLE && gco2t(f) == g->travtable);  /* partial */
   else {  /* generational mode */
     if ((getage(f) == G_OLD && isblack(f)) && !isold(t))
       return 0;
@@ -394,10 +395,25 @@ static void checkvalref (global_State *g, GCObject *f, const TValue *t) {
 }
 
 
+static void checknodes (global_State *g, GCObject *hgc, Node *n,
+                                                      Node *limit) {
+  for (; n < limit; n++) {
+    if (!isempty(gval(n))) {
+      TValue k;
+      getnodekey(g->mainthread, &k, n);
+      assert(!keyisnil(n));
+      checkvalref(g, hgc, &k);
+      checkvalref(g, hgc, gval(n));
+    }
+  }
+}
+
+
 static void checktable (global_State *g, Table *h) {
   unsigned int i;
   unsigned int asize = h->asize;
-  Node *n, *limit = gnode(h, sizenode(h));
+  unsigned osize;
+  Node *old = ilyaH_oldnodes(h, &osize);
   GCObject *hgc = obj2gco(h);
   checkobjrefN(g, hgc, h->metatable);
   for (i = 0; i < asize; i++) {
@@ -405,14 +421,10 @@ static void checktable (global_State *g, Table *h) {
     arr2obj(h, i, &aux);
     checkvalref(g, hgc, &aux);
   }
-  for (n = gnode(h, 0); n < limit; n++) {
-    if (!isempty(gval(n))) {
-      TValue k;
-      getnodekey(g->mainthread, &k, n);
-      assert(!keyisnil(n));
-      checkvalref(g, hgc, &k);
-      checkvalref(g, hgc, gval(n));
-    }
+  checknodes(g, hgc, gnode(h, 0), gnode(h, sizenode(h)));
+  if (old != NULL) {  /* still moving an old hash part? */
+    assert(osize < sizenode(h));
+    checknodes(g, hgc, old, old + osize);
   }
 }
 
@@ -549,8 +561,15 @@ static void checkrefs (global_State *g, GCObject *o) {
 **   * old objects cannot be white.
 **   * old objects must be black, except for 'touched1', 'old0',
 **     threads, and open upvalues.
-**   * 'touched1' objects must be gray.
+**   * 'touched1' objects must be gray, except for tables with cards,
+**     which stay black (but are in a gray list anyway).
 */
+
+/* black 'touched1' table, kept in 'grayagain' by card marking */
+#define blacktouched(o)  \
+	((o)->tt == ILYA_VTABLE && hascards(gco2t(o)) && isblack(o) &&  \
+	 getage(o) == G_TOUCHED1)
+
 static void checkobject (global_State *g, GCObject *o, int maybedead,
                          int listage) {
   if (isdead(g, o))
@@ -567,7 +586,7 @@ static void checkobject (global_State *g, GCObject *o, int maybedead,
         o->tt == ILYA_VTHREAD ||
         (o->tt == ILYA_VUPVAL && upisopen(gco2upv(o))));
       }
-      assert(getage(o) != G_TOUCHED1 || isgray(o));
+      assert(getage(o) != G_TOUCHED1 || isgray(o) || blacktouched(o));
     }
     checkrefs(g, o);
   }
@@ -578,7 +597,7 @@ static l_mem checkgraylist (global_State *g, GCObject *o) {
   int total = 0;  /* count number of elements in the list */
   cast_void(g);  /* better to keep it if we need to print an object */
   while (o) {
-    assert(!!isgray(o) ^ (getage(o) == G_TOUCHED2));
+    assert(!!isgray(o) ^ (getage(o) == G_TOUCHED2 || blacktouched(o)));
     assert(!testbit(o->marked, TESTBIT));
     if (keepinvariant(g))
       l_setbit(o->marked, TESTBIT);  /* mark that object is in a gray list */
@@ -629,7 +648,7 @@ static void incifingray (global_State *g, GCObject *o, l_mem *count) {
     return;  /* upvalues are never in gray lists */
   }
   /* these are the ones that must be in gray lists */
-  if (isgray(o) || getage(o) == G_TOUCHED2) {
+  if (isgray(o) || getage(o) == G_TOUCHED2 || blacktouched(o)) {
     (*count)++;
     assert(testbit(o->marked, TESTBIT));
     resetbit(o->marked, TESTBIT);  /* prepare for next cycle */
@@ -1074,10 +1093,13 @@ static int table_query (ilya_State *L) {
   t = hvalue(obj_at(L, 1));
   asize = t->asize;
   if (i == -1) {
+    unsigned osize;
     ilya_pushinteger(L, cast(ilya_Integer, asize));
     ilya_pushinteger(L, cast(ilya_Integer, allocsizenode(t)));
     ilya_pushinteger(L, cast(ilya_Integer, asize > 0 ? *lenhint(t) : 0));
-    return 3;
+    ilyaH_oldnodes(t, &osize);  /* size of an old hash part being moved */
+    ilya_pushinteger(L, cast(ilya_Integer, osize));
+    return 4;
   }
   else if (cast_uint(i) < asize) {
     ilya_pushinteger(L, i);
@@ -1148,11 +1170,24 @@ static int string_query (ilya_State *L) {
   else if (s < tb->size) {
     TString *ts;
     int n = 0;
+    int i;
     for (ts = tb->hash[s]; ts != NULL; ts = ts->u.hnext) {
+      ilyaL_checkstack(L, 1, NULL);
       setsvalue2s(L, L->top.p, ts);
       api_incr_top(L);
       n++;
     }
+    /* during a resize, strings of bucket 's' may be in old buckets */
+    for (i = tb->moved; tb->old != NULL && i < tb->oldsize; i++) {
+      for (ts = tb->old[i]; ts != NULL; ts = ts->u.hnext) {
+        if (cast_int(lmod(ts->hash, tb->size)) == s) {
+          ilyaL_checkstack(L, 1, NULL);
+          setsvalue2s(L, L->top.p, ts);
+          api_incr_top(L);
+          n++;
+        }
+      }
+    }
     return n;
   }
   else return 0;
@@ -1288,6 +1323,32 @@ static int newstate (ilya_State *L) {
 }
 
 
+static int newarena (ilya_State *L) {
+  ilya_State *L1 = ilyaL_newarena();
+  if (L1) {
+    ilya_atpanic(L1, tpanic);
+    ilyaL_openselectedlibs(L1, ~0, 0);  /* (cannot load 'T') */
+    ilya_pushlightuserdata(L, L1);
+  }
+  else
+    ilya_pushnil(L);
+  return 1;
+}
+
+
+static int newslabstate (ilya_State *L) {
+  ilya_State *L1 = ilyaL_newslabstate();
+  if (L1) {
+    ilya_atpanic(L1, tpanic);
+    ilyaL_openselectedlibs(L1, ~0, 0);  /* (cannot load 'T') */
+    ilya_pushlightuserdata(L, L1);
+  }
+  else
+    ilya_pushnil(L);
+  return 1;
+}
+
+
 static ilya_State *getstate (ilya_State *L) {
   ilya_State *L1 = cast(ilya_State *, ilya_touserdata(L, 1));
   ilyaL_argcheck(L, L1 != NULL, 1, "state expected");
@@ -1309,12 +1370,38 @@ static int loadlib (ilya_State *L) {
   return 0;
 }
 
+static int internlimit (ilya_State *L) {
+  ilya_State *L1 = getstate(L);
+  int limit = cast_int(ilyaL_checkinteger(L, 2));
+  ilya_pushinteger(L, ilya_internlimit(L1, limit));
+  return 1;
+}
+
 static int closestate (ilya_State *L) {
   ilya_State *L1 = getstate(L);
   ilya_close(L1);
   return 0;
 }
 
+
+/*
+** Counters of the slab allocator of a state ('nalloc', 'nfree',
+** 'nlarge', 'nslabs', and 'nreleased'), or fail if it has none.
+*/
+static int allocstats (ilya_State *L) {
+  ilyaL_AllocStats st;
+  if (!ilyaL_allocstats(getstate(L), &st)) {
+    ilyaL_pushfail(L);
+    return 1;
+  }
+  ilya_pushinteger(L, cast(ilya_Integer, st.nalloc));
+  ilya_pushinteger(L, cast(ilya_Integer, st.nfree));
+  ilya_pushinteger(L, cast(ilya_Integer, st.nlarge));
+  ilya_pushinteger(L, cast(ilya_Integer, st.nslabs));
+  ilya_pushinteger(L, cast(ilya_Integer, st.nreleased));
+  return 5;
+}
+
 static int doremote (ilya_State *L) {
   ilya_State *L1 = getstate(L);
   size_t lcode;
@@ -1424,6 +1511,42 @@ static int externstr (ilya_State *L) {
 }
 
 
+/* number of buffers released by 'countedfree' */
+static int nexternfree = 0;
+
+static void *countedfree (void *ud, void *ptr, size_t osize, size_t nsize) {
+  (void)ud; (void)osize; (void)nsize;
+  ilya_assert(nsize == 0);
+  nexternfree++;
+  free(ptr);
+  return NULL;
+}
+
+
+/*
+** If given a state, a name, and a string, set a global with that name
+** in that state to an external string with the string contents, in a
+** buffer whose release is counted. Returns how many of these buffers
+** were released so far.
+*/
+static int externfree (ilya_State *L) {
+  if (!ilya_isnone(L, 1)) {
+    ilya_State *L1 = getstate(L);
+    const char *name = ilyaL_checkstring(L, 2);
+    size_t len;
+    const char *s = ilyaL_checklstring(L, 3, &len);
+    char *buff = cast_charp(malloc(len + 1));
+    if (buff == NULL)
+      return ilyaL_error(L, "not enough memory");
+    memcpy(buff, s, (len + 1) * sizeof(char));
+    ilya_pushexternalstring(L1, buff, len, countedfree, NULL);
+    ilya_setglobal(L1, name);
+  }
+  ilya_pushinteger(L, nexternfree);
+  return 1;
+}
+
+
 /*
 ** {====================================================================
 ** fn to test the API with C. It interprets a kind of assembler
@@ -1823,6 +1946,10 @@ static int runC (ilya_State *L, ilya_State *L1, const char *pc) {
     else if EQ("alloccount") {
       l_memcontrol.countlimit = cast_uint(getnum);
     }
+    else if EQ("setmemlimit") {  /* (-1 sets the largest limit) */
+      size_t old = ilya_setmemlimit(L1, cast_sizet(getnum));
+      ilya_pushinteger(L1, cast(ilya_Integer, old));
+    }
     else if EQ("return") {
       int n = getnum;
       if (L1 != L) {
@@ -2107,6 +2234,10 @@ static const struct ilyaL_Reg tests_funcs[] = {
   {"listlocals", listlocals},
   {"loadlib", loadlib},
   {"checkpanic", checkpanic},
+  {"newarena", newarena},
+  {"newslabstate", newslabstate},
+  {"allocstats", allocstats},
+  {"internlimit", internlimit},
   {"newstate", newstate},
   {"newuserdata", newuserdata},
   {"num2int", num2int},
@@ -2133,6 +2264,7 @@ static const struct ilyaL_Reg tests_funcs[] = {
   {"upvalue", upvalue},
   {"externKstr", externKstr},
   {"externstr", externstr},
+  {"externfree", externfree},
   {NULL, NULL}
 };
 
@@ -2155,6 +2287,10 @@ int ilyaB_opentests (ilya_State *L) {
   ilya_assert(f == debug_realloc && ud == cast_voidp(&l_memcontrol));
   ilya_setallocf(L, f, ud);  /* exercise this fn */
   ilyaL_newlib(L, tests_funcs);
+#if defined(ILYA_SWISSHASH)
+  ilya_pushboolean(L, 1);
+  ilya_setfield(L, -2, "swisshash");  /* hash parts have other sizes */
+#endif
   return 1;
 }
 
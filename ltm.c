@@ -100,6 +100,16 @@ const char *ilyaT_objtypename (ilya_State *L, const TValue *o) {
 }
 
 
+/*
+** Return the standard name of type 't'. Modules compiled before this
+** one in the one-file build cannot see 'ilyaT_typenames_' and must
+** use this function instead of 'ttypename'.
+*/
+const char *ilyaT_typename (int t) {
+  return ttypename(t);
+}
+
+
 void ilyaT_callTM (ilya_State *L, const TValue *f, const TValue *p1,
                   const TValue *p2, const TValue *p3) {
   StkId func = L->top.p;
@@ -48,8 +48,8 @@ typedef enum {
 /*
 ** Mask with 1 in all fast-access methods. A 1 in any of these bits
 ** in the flag of a (meta)table means the metatable does not have the
-** corresponding metamethod field. (Bit 6 of the flag indicates that
-** the table is using the dummy node; bit 7 is used for 'isrealasize'.)
+** corresponding metamethod field. (Bit 6 of the flag marks frozen
+** tables; bit 7 marks tables with a card set.)
 */
 #define maskflags	cast_byte(~(~0u << (TM_EQ + 1)))
 
@@ -73,6 +73,7 @@ ILYAI_DDEC(const char *const ilyaT_typenames_[ILYA_TOTALTYPES];)
 
 
 ILYAI_FUNC const char *ilyaT_objtypename (ilya_State *L, const TValue *o);
+ILYAI_FUNC const char *ilyaT_typename (int t);
 
 ILYAI_FUNC const TValue *ilyaT_gettm (Table *events, TMS event, TString *ename);
 ILYAI_FUNC const TValue *ilyaT_gettmbyobj (ilya_State *L, const TValue *o,
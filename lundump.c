@@ -163,8 +163,8 @@ static void loadString (LoadState *S, Proto *p, TString **sl) {
     ilyaC_objbarrier(L, p, ts);
     return;  /* do not save it again */
   }
-  else if ((size -= 2) <= ILYAI_MAXSHORTLEN) {  /* short string? */
-    char buff[ILYAI_MAXSHORTLEN + 1];  /* extra space for '\0' */
+  else if ((size -= 2) <= shrlimit(L)) {  /* short string? */
+    char buff[ILYAI_MAXSHRLIMIT + 1];  /* extra space for '\0' */
     loadVector(S, buff, size + 1);  /* load string into buffer */
     *sl = ts = ilyaS_newlstr(L, buff, size);  /* create string */
     ilyaC_objbarrier(L, p, ts);
@@ -340,6 +340,7 @@ static void loadFunction (LoadState *S, Proto *f) {
   loadProtos(S, f);
   loadString(S, f, &f->source);
   loadDebug(S, f);
+  ilyaC_acctsize(S->L, f);
 }
 
 
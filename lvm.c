@@ -333,11 +333,13 @@ void ilyaV_finishset (ilya_State *L, const TValue *t, TValue *key,
     const TValue *tm;  /* '__newindex' metamethod */
     if (hres != HNOTATABLE) {  /* is 't' a table? */
       Table *h = hvalue(t);  /* save 't' table */
+      if (l_unlikely(isfrozen(h)))
+        ilyaG_runerror(L, "attempt to modify a frozen table");
       tm = fasttm(L, h->metatable, TM_NEWINDEX);  /* get metamethod */
       if (tm == NULL) {  /* no metamethod? */
         ilyaH_finishset(L, h, key, val, hres);  /* set new value */
         invalidateTMcache(h);
-        ilyaC_barrierback(L, obj2gco(h), val);
+        ilyaC_barriertable(L, h, key, val);
         return;
       }
       /* else will try the metamethod */
@@ -370,7 +372,7 @@ void ilyaV_finishset (ilya_State *L, const TValue *t, TValue *key,
 ** of the strings. Note that segments can compare equal but still
 ** have different lengths.
 */
-static int l_strcmp (const TString *ts1, const TString *ts2) {
+int ilyaV_strcmp (const TString *ts1, const TString *ts2) {
   size_t rl1;  /* real length */
   const char *s1 = getlstr(ts1, rl1);
   size_t rl2;
@@ -519,7 +521,7 @@ l_sinline int LEnum (const TValue *l, const TValue *r) {
 static int lessthanothers (ilya_State *L, const TValue *l, const TValue *r) {
   ilya_assert(!ttisnumber(l) || !ttisnumber(r));
   if (ttisstring(l) && ttisstring(r))  /* both are strings? */
-    return l_strcmp(tsvalue(l), tsvalue(r)) < 0;
+    return ilyaV_strcmp(tsvalue(l), tsvalue(r)) < 0;
   else
     return ilyaT_callorderTM(L, l, r, TM_LT);
 }
@@ -541,7 +543,7 @@ int ilyaV_lessthan (ilya_State *L, const TValue *l, const TValue *r) {
 static int lessequalothers (ilya_State *L, const TValue *l, const TValue *r) {
   ilya_assert(!ttisnumber(l) || !ttisnumber(r));
   if (ttisstring(l) && ttisstring(r))  /* both are strings? */
-    return l_strcmp(tsvalue(l), tsvalue(r)) <= 0;
+    return ilyaV_strcmp(tsvalue(l), tsvalue(r)) <= 0;
   else
     return ilyaT_callorderTM(L, l, r, TM_LE);
 }
@@ -663,8 +665,8 @@ void ilyaV_concat (ilya_State *L, int total) {
         }
         tl += l;
       }
-      if (tl <= ILYAI_MAXSHORTLEN) {  /* is result a short string? */
-        char buff[ILYAI_MAXSHORTLEN];
+      if (tl <= shrlimit(L)) {  /* is result a short string? */
+        char buff[ILYAI_MAXSHRLIMIT];
         copy2buff(top, n, buff);  /* copy strings to buffer */
         ts = ilyaS_newlstr(L, buff, tl);
       }
@@ -1311,7 +1313,7 @@ void ilyaV_execute (ilya_State *L, CallInfo *ci) {
         TString *key = tsvalue(rb);  /* key must be a short string */
         ilyaV_fastset(upval, key, rc, hres, ilyaH_psetshortstr);
         if (hres == HOK)
-          ilyaV_finishfastset(L, upval, rc);
+          ilyaV_finishfastset(L, upval, rb, rc);
         else
           Protect(ilyaV_finishset(L, upval, rb, rc, hres));
         vmbreak;
@@ -1328,7 +1330,7 @@ void ilyaV_execute (ilya_State *L, CallInfo *ci) {
           ilyaV_fastset(s2v(ra), rb, rc, hres, ilyaH_pset);
         }
         if (hres == HOK)
-          ilyaV_finishfastset(L, s2v(ra), rc);
+          ilyaV_finishfastset(L, s2v(ra), rb, rc);
         else
           Protect(ilyaV_finishset(L, s2v(ra), rb, rc, hres));
         vmbreak;
@@ -1339,8 +1341,11 @@ void ilyaV_execute (ilya_State *L, CallInfo *ci) {
         int b = GETARG_B(i);
         TValue *rc = RKC(i);
         ilyaV_fastseti(s2v(ra), b, rc, hres);
-        if (hres == HOK)
-          ilyaV_finishfastset(L, s2v(ra), rc);
+        if (hres == HOK) {
+          TValue key;
+          setivalue(&key, b);
+          ilyaV_finishfastset(L, s2v(ra), &key, rc);
+        }
         else {
           TValue key;
           setivalue(&key, b);
@@ -1356,7 +1361,7 @@ void ilyaV_execute (ilya_State *L, CallInfo *ci) {
         TString *key = tsvalue(rb);  /* key must be a short string */
         ilyaV_fastset(s2v(ra), key, rc, hres, ilyaH_psetshortstr);
         if (hres == HOK)
-          ilyaV_finishfastset(L, s2v(ra), rc);
+          ilyaV_finishfastset(L, s2v(ra), rb, rc);
         else
           Protect(ilyaV_finishset(L, s2v(ra), rb, rc, hres));
         vmbreak;
@@ -102,7 +102,7 @@ typedef enum {
 /*
 ** Finish a fast set operation (when fast set succeeds).
 */
-#define ilyaV_finishfastset(L,t,v)	ilyaC_barrierback(L, gcvalue(t), v)
+#define ilyaV_finishfastset(L,t,k,v)	ilyaC_barriertable(L, hvalue(t), k, v)
 
 
 /*
@@ -113,6 +113,7 @@ typedef enum {
 
 
 ILYAI_FUNC int ilyaV_equalobj (ilya_State *L, const TValue *t1, const TValue *t2);
+ILYAI_FUNC int ilyaV_strcmp (const TString *ts1, const TString *ts2);
 ILYAI_FUNC int ilyaV_lessthan (ilya_State *L, const TValue *l, const TValue *r);
 ILYAI_FUNC int ilyaV_lessequal (ilya_State *L, const TValue *l, const TValue *r);
 ILYAI_FUNC int ilyaV_tonumber_ (const TValue *obj, ilya_Number *n);
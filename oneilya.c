@@ -78,6 +78,7 @@
 #include "lundump.c"
 #include "ldump.c"
 #include "lstate.c"
+#include "ltable.c"
 #include "lgc.c"
 #include "llex.c"
 #include "lcode.c"
@@ -87,7 +88,6 @@
 #include "lobject.c"
 #include "ltm.c"
 #include "lstring.c"
-#include "ltable.c"
 #include "ldo.c"
 #include "lvm.c"
 #include "lapi.c"